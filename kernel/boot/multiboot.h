@@ -0,0 +1,48 @@
+/*
+ * Multiboot information structure, as given by the boot loader.
+ * Cf. Multiboot Specification version 0.6.96
+ */
+#ifndef __MULTIBOOT_H__
+#define __MULTIBOOT_H__
+
+#include "stdint.h"
+
+/** Value of eax when loaded by a multiboot compliant boot loader */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/** mem_lower and mem_upper are valid */
+#define MULTIBOOT_INFO_MEMORY 0x001
+/** mmap_addr and mmap_length are valid */
+#define MULTIBOOT_INFO_MEM_MAP 0x040
+
+/** Memory map entry type of usable RAM */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+struct multiboot_info {
+  uint32_t flags;
+  /** Kilobytes of memory below 1M */
+  uint32_t mem_lower;
+  /** Kilobytes of memory above 1M */
+  uint32_t mem_upper;
+  uint32_t boot_device;
+  uint32_t cmdline;
+  uint32_t mods_count;
+  uint32_t mods_addr;
+  uint32_t syms[4];
+  uint32_t mmap_length;
+  uint32_t mmap_addr;
+};
+
+struct multiboot_mmap_entry {
+  /** Size of the entry without this field */
+  uint32_t size;
+  uint64_t addr;
+  uint64_t len;
+  uint32_t type;
+} __attribute__((packed));
+
+/** Saved by crt0 */
+extern uint32_t multiboot_magic;
+extern struct multiboot_info *multiboot_info;
+
+#endif
@@ -0,0 +1,91 @@
+#include "buddy.h"
+
+#include "debug.h"
+#include "stddef.h"
+
+/** Order of allocated units or of non free block parts */
+#define BUDDY_USED 0xff
+
+static void free_push(struct buddy_t *b, unsigned long index, unsigned order) {
+  struct buddy_block_t *const f = &b->blocks[index];
+  struct buddy_block_t **const head = &b->free_lists[order];
+  f->order = order;
+  f->next = *head;
+  if (*head != NULL) (*head)->pprev = &f->next;
+  f->pprev = head;
+  *head = f;
+}
+static void free_remove(struct buddy_block_t *f) {
+  *f->pprev = f->next;
+  if (f->next != NULL) f->next->pprev = f->pprev;
+  f->order = BUDDY_USED;
+}
+
+void buddy_init(struct buddy_t *b, uint32_t base, unsigned long nunits, unsigned shift,
+                unsigned max_order, struct buddy_block_t *blocks) {
+  assert(max_order <= BUDDY_MAX_ORDER);
+  b->base = base;
+  b->shift = shift;
+  b->max_order = max_order;
+  b->blocks = blocks;
+  b->nunits = nunits;
+  for (unsigned o = 0; o <= BUDDY_MAX_ORDER; o++) b->free_lists[o] = NULL;
+  b->total = 0;
+  b->free = 0;
+  for (unsigned long i = 0; i < nunits; i++) blocks[i].order = BUDDY_USED;
+}
+
+uint32_t buddy_alloc(struct buddy_t *b, unsigned order) {
+  unsigned o = order;
+  while (o <= b->max_order && b->free_lists[o] == NULL) o++;
+  if (o > b->max_order) return 0;
+
+  struct buddy_block_t *const f = b->free_lists[o];
+  free_remove(f);
+  const unsigned long index = f - b->blocks;
+  // Give back upper halves
+  while (o > order) {
+    o--;
+    free_push(b, index + (1ul << o), o);
+  }
+  b->free -= 1ul << order;
+  return b->base + (index << b->shift);
+}
+
+void buddy_free(struct buddy_t *b, uint32_t addr, unsigned order) {
+  assert(addr >= b->base);
+  unsigned long index = (addr - b->base) >> b->shift;
+  assert(index < b->nunits && (index & ((1ul << order) - 1)) == 0);
+  assert(b->blocks[index].order == BUDDY_USED);
+  b->free += 1ul << order;
+
+  // Merge with free buddies
+  while (order < b->max_order) {
+    const unsigned long buddy = index ^ (1ul << order);
+    if (buddy >= b->nunits || b->blocks[buddy].order != order) break;
+    free_remove(&b->blocks[buddy]);
+    if (buddy < index) index = buddy;
+    order++;
+  }
+  free_push(b, index, order);
+}
+
+void buddy_add(struct buddy_t *b, uint32_t start, uint32_t end) {
+  const uint32_t unit = 1u << b->shift;
+  const uint32_t limit = b->base + (b->nunits << b->shift);
+  if (start < b->base) start = b->base;
+  if (end > limit) end = limit;
+  start = (start + unit - 1) & ~(unit - 1);
+  end &= ~(unit - 1);
+
+  while (start < end) {
+    unsigned order = b->max_order;
+    while ((((start - b->base) >> b->shift) & ((1ul << order) - 1)) != 0 ||
+           start + (unit << order) > end || start + (unit << order) < start) {
+      order--;
+    }
+    b->total += 1ul << order;
+    buddy_free(b, start, order);
+    start += unit << order;
+  }
+}
@@ -0,0 +1,47 @@
+/*
+ * Binary buddy allocator over a range of equal size units, with descriptors
+ * kept out of the managed memory.
+ */
+#ifndef __BUDDY_H__
+#define __BUDDY_H__
+
+#include "stdint.h"
+
+/** Largest supported order */
+#define BUDDY_MAX_ORDER 11
+
+struct buddy_block_t {
+  /** Next block in free list */
+  struct buddy_block_t *next;
+  /** Previous next pointer in free list */
+  struct buddy_block_t **pprev;
+  /** Order of the free block starting at this unit or BUDDY_USED */
+  uint8_t order;
+};
+
+struct buddy_t {
+  /** Address of first unit. Blocks are aligned relative to it */
+  uint32_t base;
+  /** Unit size is 1 << shift */
+  unsigned shift;
+  unsigned max_order;
+  /** Descriptor of each unit */
+  struct buddy_block_t *blocks;
+  unsigned long nunits;
+  struct buddy_block_t *free_lists[BUDDY_MAX_ORDER + 1];
+  /** Added and free units count */
+  unsigned long total;
+  unsigned long free;
+};
+
+/** Initialize with all units used. blocks has nunits descriptors */
+void buddy_init(struct buddy_t *b, uint32_t base, unsigned long nunits, unsigned shift,
+                unsigned max_order, struct buddy_block_t *blocks);
+/** Release units in [start, end) as the largest aligned blocks */
+void buddy_add(struct buddy_t *b, uint32_t start, uint32_t end);
+/** Allocate 2^order contiguous units. Returns address or 0 */
+uint32_t buddy_alloc(struct buddy_t *b, unsigned order);
+/** Release a block from buddy_alloc with the same order */
+void buddy_free(struct buddy_t *b, uint32_t addr, unsigned order);
+
+#endif
@@ -115,4 +115,46 @@ __inline__ static unsigned long inl(unsigned short port)
 	return rega;
 }
 
+/* Cf. CPUID instruction, Intel Architecture Software Developer's Manual Volume 2 */
+__inline__ static void cpuid(unsigned leaf, unsigned *eax, unsigned *ebx,
+			     unsigned *ecx, unsigned *edx)
+{
+	__asm__ __volatile__("cpuid"
+			     : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+			     : "0" (leaf));
+}
+
+/* Linear address of the last page fault */
+__inline__ static unsigned long get_cr2(void)
+{
+	unsigned long cr2;
+	__asm__ __volatile__("movl %%cr2,%0" : "=r" (cr2));
+	return cr2;
+}
+
+__inline__ static unsigned long get_cr3(void)
+{
+	unsigned long cr3;
+	__asm__ __volatile__("movl %%cr3,%0" : "=r" (cr3));
+	return cr3;
+}
+
+/* Load a page directory, flushing non global TLB entries */
+__inline__ static void set_cr3(unsigned long cr3)
+{
+	__asm__ __volatile__("movl %0,%%cr3" : : "r" (cr3) : "memory");
+}
+
+__inline__ static unsigned long get_cr4(void)
+{
+	unsigned long cr4;
+	__asm__ __volatile__("movl %%cr4,%0" : "=r" (cr4));
+	return cr4;
+}
+
+__inline__ static void set_cr4(unsigned long cr4)
+{
+	__asm__ __volatile__("movl %0,%%cr4" : : "r" (cr4) : "memory");
+}
+
 #endif
@@ -4,6 +4,7 @@
 #include "gdb_serial_support.h"
 #include "cpu.h"
 #include "string.h"
+#include "fault.h"
 
 static int do_debug = 0;
 
@@ -200,6 +201,8 @@ void trap_handler(unsigned trapno, unsigned error_code)
 	__asm__ __volatile__("str %%eax" : "=a" (tr));
 	struct x86_tss *t = tss_sel_2_tss(tss_sel_2_tss(tr)->back_link);
 
+	if (trapno == 14 && page_fault(error_code, t) == 0) return;
+
 	if (do_debug) {
 		debugger(trapno, error_code, t);
 	} else {
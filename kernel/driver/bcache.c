@@ -0,0 +1,298 @@
+#include "debug.h"
+#include "interrupt.h"
+#include "mem.h"
+#include "scheduler.h"
+#include "string.h"
+#include "bcache.h"
+
+static void lru_remove(struct bcache_buf_t *b) {
+  b->lru_prev->lru_next = b->lru_next;
+  b->lru_next->lru_prev = b->lru_prev;
+}
+/** Most recently used go last */
+static void lru_push(struct bcache_t *c, struct bcache_buf_t *b) {
+  b->lru_prev = c->lru.lru_prev;
+  b->lru_next = &c->lru;
+  c->lru.lru_prev->lru_next = b;
+  c->lru.lru_prev = b;
+}
+
+static struct bcache_buf_t **bucket(struct bcache_t *c, addr_t block) {
+  return &c->hash[block % BCACHE_HASH];
+}
+static struct bcache_buf_t *lookup(struct bcache_t *c, addr_t block) {
+  struct bcache_buf_t *b = *bucket(c, block);
+  while (b != NULL && b->block != block) b = b->hash_next;
+  return b;
+}
+static void hash_remove(struct bcache_t *c, struct bcache_buf_t *b) {
+  struct bcache_buf_t **p = bucket(c, b->block);
+  while (*p != b) p = &(*p)->hash_next;
+  *p = b->hash_next;
+}
+
+static void acquire(struct bcache_t *c) {
+  while (c->owner != NULL) wait_clock(current_clock() + 1);
+  c->owner = getproc();
+}
+static void release(struct bcache_t *c) { c->owner = NULL; }
+/** Held while the cache is examined or changed, not during transfers */
+static void lock(struct bcache_t *c) {
+  acquire(c);
+  uninterruptible_enter();
+}
+static void unlock(struct bcache_t *c) {
+  release(c);
+  uninterruptible_leave();
+}
+/** Let transfers of other processes progress, still uninterruptible as
+ * buffers may be held */
+static void wait_io(struct bcache_t *c) {
+  release(c);
+  wait_clock(current_clock() + 1);
+  acquire(c);
+}
+
+/** Sectors of a block */
+#define BLOCK_SECTORS (BCACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+
+/** Run bio on buffers marked io, without the lock so other processes use
+ * the cache and queue their own requests meanwhile */
+static void transfer(struct bcache_t *c, struct bio_t *bio) {
+  release(c);
+  const int ret = block_submit_wait(c->backend, bio);
+  acquire(c);
+  assert(ret >= 0);
+  (void)ret;
+}
+
+/** Write back b and the cached dirty blocks following it in one request.
+ * Releases the lock meanwhile */
+static void write_run(struct bcache_t *c, struct bcache_buf_t *b) {
+  struct bcache_buf_t *run[BCACHE_RUN_BLOCKS];
+  struct bio_t bio;
+  bio_init(&bio, BIO_WRITE, b->block * BLOCK_SECTORS, BIO_PRIO_WRITEBACK);
+  struct bcache_buf_t *next = b;
+  do {
+    bio_add(&bio, next->data, BCACHE_BLOCK_SIZE);
+    // Written again if changed once the transfer is over
+    next->dirty = false;
+    next->io = true;
+    run[bio.nsegs - 1] = next;
+  } while (bio.nsegs < BCACHE_RUN_BLOCKS && (next = lookup(c, b->block + bio.nsegs)) != NULL &&
+           next->dirty && !next->io);
+  c->writebacks += bio.nsegs;
+  transfer(c, &bio);
+  for (int i = 0; i < bio.nsegs; i++) run[i]->io = false;
+}
+
+/** Buffer of block if cached, else a buffer claimed for it from the least
+ * recently used, with io set until the caller loads it. Returns NULL rather
+ * than wait for a transfer if !may_wait. May release the lock */
+static struct bcache_buf_t *find_or_claim(struct bcache_t *c, addr_t block, bool may_wait,
+                                          bool *claimed) {
+  for (;;) {
+    struct bcache_buf_t *b = lookup(c, block);
+    if (b == NULL) {
+      b = c->lru.lru_next;
+      while (b != &c->lru && b->io) b = b->lru_next;
+    }
+    if (b == &c->lru || b->io) {
+      if (!may_wait) return NULL;
+      wait_io(c);
+      continue;
+    }
+    *claimed = b->block != block || !b->valid;
+    if (!*claimed) return b;
+    if (b->valid && b->dirty) {
+      // Buffers may change meanwhile: look again
+      write_run(c, b);
+      continue;
+    }
+    if (b->valid) {
+      hash_remove(c, b);
+      c->evictions++;
+    }
+    b->block = block;
+    b->valid = true;
+    b->dirty = false;
+    b->io = true;
+    b->hash_next = *bucket(c, block);
+    *bucket(c, block) = b;
+    return b;
+  }
+}
+
+/** Buffer holding block, loaded from backend if fill. May release the lock */
+static struct bcache_buf_t *get_block(struct bcache_t *c, addr_t block, bool fill) {
+  bool claimed;
+  struct bcache_buf_t *const b = find_or_claim(c, block, true, &claimed);
+  if (!claimed) {
+    c->hits++;
+  } else {
+    c->misses++;
+    if (fill) {
+      struct bio_t bio;
+      bio_init(&bio, BIO_READ, block * BLOCK_SECTORS, BIO_PRIO_DEMAND);
+      bio_add(&bio, b->data, BCACHE_BLOCK_SIZE);
+      transfer(c, &bio);
+    }
+    b->io = false;
+  }
+  lru_remove(b);
+  lru_push(c, b);
+  return b;
+}
+
+static void bcache_disk_read(void *arg, void *dst, addr_t addr, size_t n) {
+  struct bcache_t *const c = arg;
+  char *p = dst;
+  lock(c);
+  while (n > 0) {
+    const size_t offset = addr & (BCACHE_BLOCK_SIZE - 1);
+    size_t count = BCACHE_BLOCK_SIZE - offset;
+    if (count > n) count = n;
+    const struct bcache_buf_t *const b = get_block(c, addr >> BCACHE_BLOCK_SHIFT, true);
+    memcpy(p, b->data + offset, count);
+    p += count;
+    addr += count;
+    n -= count;
+  }
+  unlock(c);
+}
+static void bcache_disk_write(void *arg, addr_t addr, const void *src, size_t n) {
+  struct bcache_t *const c = arg;
+  const char *p = src;
+  lock(c);
+  while (n > 0) {
+    const size_t offset = addr & (BCACHE_BLOCK_SIZE - 1);
+    size_t count = BCACHE_BLOCK_SIZE - offset;
+    if (count > n) count = n;
+    // Whole blocks are not read before being overwritten
+    struct bcache_buf_t *const b = get_block(c, addr >> BCACHE_BLOCK_SHIFT, count < BCACHE_BLOCK_SIZE);
+    memcpy(b->data + offset, p, count);
+    b->dirty = true;
+    p += count;
+    addr += count;
+    n -= count;
+  }
+  unlock(c);
+}
+static const void *bcache_disk_view(void *arg, addr_t addr, size_t *size) {
+  struct bcache_t *const c = arg;
+  const size_t offset = addr & (BCACHE_BLOCK_SIZE - 1);
+  lock(c);
+  const struct bcache_buf_t *const b = get_block(c, addr >> BCACHE_BLOCK_SHIFT, true);
+  unlock(c);
+  if (size) *size = BCACHE_BLOCK_SIZE - offset;
+  return b->data + offset;
+}
+
+static void bcache_disk_flush(void *arg) { bcache_sync(arg); }
+
+void new_bcache_disk(struct disk_t *d, struct bcache_t *c, struct block_dev_t *backend, size_t nblocks) {
+  assert(BCACHE_RUN_BLOCKS <= BIO_SEGMENTS && BCACHE_BLOCK_SHIFT >= BLOCK_SECTOR_SHIFT);
+  memset(c, 0, sizeof(*c));
+  c->backend = backend;
+  c->nblocks = nblocks;
+  c->bufs = mem_alloc(nblocks * sizeof(struct bcache_buf_t));
+  char *const data = mem_alloc(nblocks << BCACHE_BLOCK_SHIFT);
+  assert(c->bufs && data);
+
+  c->lru.lru_prev = c->lru.lru_next = &c->lru;
+  for (size_t i = 0; i < nblocks; i++) {
+    memset(&c->bufs[i], 0, sizeof(c->bufs[i]));
+    c->bufs[i].data = data + (i << BCACHE_BLOCK_SHIFT);
+    lru_push(c, &c->bufs[i]);
+  }
+
+  d->arg = c;
+  d->read = bcache_disk_read;
+  d->write = bcache_disk_write;
+  d->view = bcache_disk_view;
+  d->flush = bcache_disk_flush;
+}
+
+void bcache_prefetch(struct bcache_t *c, addr_t addr, size_t n) {
+  if (n == 0) return;
+  const addr_t last = (addr + n - 1) >> BCACHE_BLOCK_SHIFT;
+  lock(c);
+  for (addr_t block = addr >> BCACHE_BLOCK_SHIFT; block <= last;) {
+    if (lookup(c, block) != NULL) {
+      block++;
+      continue;
+    }
+    // Buffers are claimed first, then loaded by one request. A hint never
+    // waits for other transfers
+    struct bcache_buf_t *run[BCACHE_RUN_BLOCKS];
+    struct bio_t bio;
+    bio_init(&bio, BIO_READ, block * BLOCK_SECTORS, BIO_PRIO_AHEAD);
+    struct bcache_buf_t *b = NULL;
+    bool claimed = true;
+    while (bio.nsegs < BCACHE_RUN_BLOCKS && block + bio.nsegs <= last) {
+      b = find_or_claim(c, block + bio.nsegs, false, &claimed);
+      if (b == NULL || !claimed) break;
+      run[bio.nsegs] = b;
+      bio_add(&bio, b->data, BCACHE_BLOCK_SIZE);
+    }
+    const int count = bio.nsegs;
+    if (count == 0) {
+      // Loaded meanwhile, or every buffer is in a transfer
+      if (b == NULL) break;
+      block++;
+      continue;
+    }
+    transfer(c, &bio);
+    for (int i = 0; i < count; i++) {
+      run[i]->io = false;
+      lru_remove(run[i]);
+      lru_push(c, run[i]);
+    }
+    c->prefetches += count;
+    block += count;
+  }
+  unlock(c);
+}
+
+void bcache_sync(struct bcache_t *c) {
+  lock(c);
+  // Lowest dirty block first, so runs are as long as possible. Ends once
+  // writes of other processes are over too
+  for (;;) {
+    struct bcache_buf_t *first = NULL;
+    bool io = false;
+    for (size_t i = 0; i < c->nblocks; i++) {
+      struct bcache_buf_t *const b = &c->bufs[i];
+      io |= b->io;
+      if (b->dirty && !b->io && (first == NULL || b->block < first->block)) first = b;
+    }
+    if (first != NULL) {
+      write_run(c, first);
+    } else if (io) {
+      wait_io(c);
+    } else {
+      break;
+    }
+  }
+  unlock(c);
+}
+
+void bcache_status(const struct bcache_t *c, struct disk_cache_status_t *status) {
+  status->block_size = BCACHE_BLOCK_SIZE;
+  status->blocks = c->nblocks;
+  status->used = 0;
+  status->dirty = 0;
+  for (size_t i = 0; i < c->nblocks; i++) {
+    if (c->bufs[i].valid) status->used++;
+    if (c->bufs[i].dirty) status->dirty++;
+  }
+  status->hits = c->hits;
+  status->misses = c->misses;
+  status->writebacks = c->writebacks;
+  status->evictions = c->evictions;
+  status->prefetches = c->prefetches;
+}
+
+void bcache_release(struct bcache_t *c, const struct process_t *ps) {
+  if (c->owner == ps) c->owner = NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef BCACHE_H_
+#define BCACHE_H_
+
+#include "stdbool.h"
+#include "block.h"
+#include "disk.h"
+#include "system.h"
+
+/** Cached blocks are sectors */
+#define BCACHE_BLOCK_SHIFT 9
+#define BCACHE_BLOCK_SIZE (1u << BCACHE_BLOCK_SHIFT)
+/** Default cache length in blocks */
+#define BCACHE_BLOCKS 64
+#define BCACHE_HASH 32
+/** Contiguous blocks written back or prefetched by a single request */
+#define BCACHE_RUN_BLOCKS 16
+
+struct process_t;
+
+struct bcache_buf_t {
+  /** Block index on backend */
+  addr_t block;
+  bool valid;
+  bool dirty;
+  /** Loaded or written back by a request, which holds it */
+  bool io;
+  /** Same hash bucket */
+  struct bcache_buf_t *hash_next;
+  /** Least recently used first */
+  struct bcache_buf_t *lru_prev, *lru_next;
+  char *data;
+};
+
+/** Write-back cache of a disk in fixed size blocks with LRU eviction */
+struct bcache_t {
+  struct block_dev_t *backend;
+  struct bcache_buf_t *bufs;
+  size_t nblocks;
+  struct bcache_buf_t *hash[BCACHE_HASH];
+  /** LRU list sentinel */
+  struct bcache_buf_t lru;
+  /** Process using the cache or NULL, released during transfers */
+  struct process_t *owner;
+  unsigned long hits, misses, writebacks, evictions, prefetches;
+};
+
+/** Cache backend in d. Backend size must be a multiple of BCACHE_BLOCK_SIZE.
+ * Reference from disk_view is valid until next access to d */
+void new_bcache_disk(struct disk_t *d, struct bcache_t *cache,
+                     struct block_dev_t *backend, size_t nblocks);
+/** Load blocks holding disk range not cached yet, missing runs in one
+ * request each */
+void bcache_prefetch(struct bcache_t *cache, addr_t addr, size_t n);
+/** Write back all dirty blocks */
+void bcache_sync(struct bcache_t *cache);
+void bcache_status(const struct bcache_t *cache, struct disk_cache_status_t *status);
+/** Let others use cache if ps, being stopped, was using it */
+void bcache_release(struct bcache_t *cache, const struct process_t *ps);
+
+#endif /*BCACHE_H_*/
@@ -0,0 +1,129 @@
+#include "interrupt.h"
+#include "mem.h"
+#include "scheduler.h"
+#include "string.h"
+#include "block.h"
+
+void block_init(struct block_dev_t *dev, uint32_t sectors,
+                int (*serve)(struct block_dev_t *, struct bio_t *), void *arg) {
+  memset(dev, 0, sizeof(*dev));
+  dev->sectors = sectors;
+  dev->serve = serve;
+  dev->arg = arg;
+}
+
+void bio_init(struct bio_t *bio, enum bio_op op, uint32_t sector, enum bio_prio prio) {
+  memset(bio, 0, sizeof(*bio));
+  bio->op = op;
+  bio->sector = sector;
+  bio->prio = prio;
+}
+int bio_add(struct bio_t *bio, void *buf, size_t len) {
+  if (bio->nsegs == BIO_SEGMENTS) return -1;
+  bio->segs[bio->nsegs].buf = buf;
+  bio->segs[bio->nsegs].len = len;
+  bio->nsegs++;
+  return 0;
+}
+uint32_t bio_sectors(const struct bio_t *bio) {
+  size_t len = 0;
+  for (int i = 0; i < bio->nsegs; i++) len += bio->segs[i].len;
+  return len >> BLOCK_SECTOR_SHIFT;
+}
+
+/** Behind queued requests of the same priority */
+static void enqueue(struct block_dev_t *dev, struct bio_t *bio) {
+  struct bio_t **p = &dev->queue;
+  while (*p != NULL && (*p)->prio >= bio->prio) p = &(*p)->next;
+  bio->next = *p;
+  *p = bio;
+  dev->depth++;
+}
+static struct bio_t *dequeue(struct block_dev_t *dev) {
+  struct bio_t *const bio = dev->queue;
+  if (bio != NULL) {
+    dev->queue = bio->next;
+    dev->depth--;
+  }
+  return bio;
+}
+
+/** Serve the queue until it is empty, unless a process already does */
+static void run_queue(struct block_dev_t *dev) {
+  if (dev->owner != NULL) return;
+  dev->owner = getproc();
+  struct bio_t *next;
+  while ((next = dequeue(dev)) != NULL) {
+    next->status = dev->serve(dev, next);
+    next->end(next);
+  }
+  dev->owner = NULL;
+}
+
+void block_submit(struct block_dev_t *dev, struct bio_t *bio) {
+  const uint32_t count = bio_sectors(bio);
+  if (bio->sector > dev->sectors || count > dev->sectors - bio->sector) {
+    bio->status = -1;
+    bio->end(bio);
+    return;
+  }
+  uninterruptible_enter();
+  bio->owner = getproc();
+  enqueue(dev, bio);
+  run_queue(dev);
+  uninterruptible_leave();
+}
+
+static void end_wake(struct bio_t *bio) { *(bool *)bio->private = true; }
+int block_submit_wait(struct block_dev_t *dev, struct bio_t *bio) {
+  bool done = false;
+  bio->end = end_wake;
+  bio->private = &done;
+  // done and bio are on the stack until the end
+  uninterruptible_enter();
+  block_submit(dev, bio);
+  while (!done) {
+    wait_clock(current_clock() + 1);
+    // Served by the process running the driver, or here if it stopped
+    run_queue(dev);
+  }
+  uninterruptible_leave();
+  return bio->status;
+}
+
+void block_release(struct block_dev_t *dev, const struct process_t *ps) {
+  for (struct bio_t **p = &dev->queue; *p != NULL;) {
+    if ((*p)->owner == ps) {
+      *p = (*p)->next;
+      dev->depth--;
+    } else {
+      p = &(*p)->next;
+    }
+  }
+  if (dev->owner == ps) dev->owner = NULL;
+}
+int block_rw(struct block_dev_t *dev, enum bio_op op, uint32_t sector, void *buf,
+             uint32_t count, enum bio_prio prio) {
+  struct bio_t bio;
+  bio_init(&bio, op, sector, prio);
+  bio_add(&bio, buf, count << BLOCK_SECTOR_SHIFT);
+  return block_submit_wait(dev, &bio);
+}
+
+static int mem_block_serve(struct block_dev_t *dev, struct bio_t *bio) {
+  char *p = (char *)dev->arg + (bio->sector << BLOCK_SECTOR_SHIFT);
+  for (int i = 0; i < bio->nsegs; i++) {
+    if (bio->op == BIO_READ) {
+      memcpy(bio->segs[i].buf, p, bio->segs[i].len);
+    } else {
+      memcpy(p, bio->segs[i].buf, bio->segs[i].len);
+    }
+    p += bio->segs[i].len;
+  }
+  return 0;
+}
+void new_mem_block(struct block_dev_t *dev, size_t size, int erase) {
+  void *const data = mem_alloc(size);
+  memset(data, erase, size);
+  block_init(dev, size >> BLOCK_SECTOR_SHIFT, mem_block_serve, data);
+}
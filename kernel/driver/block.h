@@ -0,0 +1,106 @@
+/*
+ * Block layer.
+ *
+ * A transfer to a block device is a request over a range of sectors,
+ * gathered from or scattered to several buffers. Requests wait in the
+ * device queue, highest priority first, until its driver serves them and
+ * their completion callback runs. The process submitting to an idle device
+ * runs the driver until the queue is empty, serving requests queued
+ * meanwhile by other processes in the same pass. Submitting processes can
+ * not be killed until their requests end.
+ */
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#define BLOCK_SECTOR_SHIFT 9
+#define BLOCK_SECTOR_SIZE (1u << BLOCK_SECTOR_SHIFT)
+/** Buffers of a request */
+#define BIO_SEGMENTS 16
+
+struct process_t;
+
+enum bio_op {
+  BIO_READ,
+  BIO_WRITE
+};
+
+/** Requests of higher priority are served first */
+enum bio_prio {
+  /** Data nobody waits for yet */
+  BIO_PRIO_AHEAD,
+  BIO_PRIO_WRITEBACK,
+  /** A process waits for it */
+  BIO_PRIO_DEMAND
+};
+
+/** Part of a request in a buffer */
+struct bio_seg_t {
+  void *buf;
+  /** Multiple of BLOCK_SECTOR_SIZE */
+  size_t len;
+};
+
+struct bio_t {
+  enum bio_op op;
+  /** First sector, followed by the segments in order */
+  uint32_t sector;
+  struct bio_seg_t segs[BIO_SEGMENTS];
+  int nsegs;
+  enum bio_prio prio;
+  /** Called once served, with status set */
+  void (*end)(struct bio_t *bio);
+  void *private;
+  /** 0 or negative on error */
+  int status;
+  /** Submitting process */
+  struct process_t *owner;
+  /** Next in device queue */
+  struct bio_t *next;
+};
+
+struct block_dev_t {
+  /** Device size in sectors */
+  uint32_t sectors;
+  /** Transfer bio. May sleep. Return 0 or negative on error */
+  int (*serve)(struct block_dev_t *dev, struct bio_t *bio);
+  void *arg;
+  /** Requests not served yet */
+  struct bio_t *queue;
+  unsigned depth;
+  /** Process running the driver or NULL */
+  struct process_t *owner;
+};
+
+/** Setup dev served by serve */
+void block_init(struct block_dev_t *dev, uint32_t sectors,
+                int (*serve)(struct block_dev_t *, struct bio_t *), void *arg);
+
+/** Empty request */
+void bio_init(struct bio_t *bio, enum bio_op op, uint32_t sector, enum bio_prio prio);
+/** Append a segment. Returns -1 if bio is full */
+int bio_add(struct bio_t *bio, void *buf, size_t len);
+/** Sectors covered by bio */
+uint32_t bio_sectors(const struct bio_t *bio);
+
+/** Queue bio, ending it at once if it is out of dev. Serves the queue
+ * unless a process already does. May sleep */
+void block_submit(struct block_dev_t *dev, struct bio_t *bio);
+/** Submit bio and wait for its end. Returns its status */
+int block_submit_wait(struct block_dev_t *dev, struct bio_t *bio);
+/** Transfer count sectors from sector to one buffer and wait for it.
+ * Returns error or 0 */
+int block_rw(struct block_dev_t *dev, enum bio_op op, uint32_t sector, void *buf,
+             uint32_t count, enum bio_prio prio);
+
+/** Drop requests of ps, being stopped, and let others run the driver if
+ * ps did. Dropped requests do not end, as they may live on its stack */
+void block_release(struct block_dev_t *dev, const struct process_t *ps);
+
+/** Format dev as a device of size bytes in memory, filled with erase */
+void new_mem_block(struct block_dev_t *dev, size_t size, int erase);
+
+#endif /*BLOCK_H_*/
@@ -37,6 +37,8 @@
 #define FLOPPY_144_CYLINDER_FACE_SIZE (FLOPPY_144_SECTORS_PER_TRACK * FLOPPY_144_SECTOR_SIZE)
 #define FLOPPY_144_HEADS 2
 #define FLOPPY_144_CYLINDER_SIZE (FLOPPY_144_CYLINDER_FACE_SIZE * FLOPPY_144_HEADS)
+#define FLOPPY_144_CYLINDERS 80
+#define FLOPPY_144_SECTORS (FLOPPY_144_CYLINDERS * FLOPPY_144_SECTORS_PER_TRACK * FLOPPY_144_HEADS)
 
 // we statically reserve a totally uncomprehensive amount of memory
 // must be large enough for whatever DMA transfer we might desire
@@ -538,13 +540,6 @@ int do_cached(dir dir, uint32_t addr, uint32_t* offset, uint32_t* size) {
   return ret;
 }
 
-const char* floppy_read_view(uint32_t addr, uint32_t* size) {
-  uint32_t offset;
-  int ret = do_cached(dir_read, addr, &offset, size);
-  if (ret < 0) return NULL;
-
-  return &floppy_dmabuf[offset];
-}
 int floppy_read(char* dst, uint32_t addr, uint32_t size) {
   uint32_t offset, working_size, done_size = 0;
   int ret;
@@ -560,25 +555,41 @@ int floppy_read(char* dst, uint32_t addr, uint32_t size) {
   return 0;
 }
 
-int floppy_write(uint32_t addr, const char* src, uint32_t size) {
-  uint32_t offset, working_size, done_size = 0;
-  int ret;
-  // Writing cylinders one by one
-  while (size > done_size) {
-    // Load cylinder
-    ret = do_cached(dir_read, addr + done_size, &offset, &working_size);
-    if (ret < 0) return ret;
-
-    if (working_size > size - done_size) working_size = size - done_size;
-    // Edit buffer
-    memcpy(&floppy_dmabuf[offset], src + done_size, working_size);
-
-    // Save cylinder
-    ret = do_cached(dir_write, addr + done_size, NULL, NULL);
-    if (ret < 0) return ret;
-    done_size += working_size;
+/** Write segments of bio, saving each cylinder once all its segments are
+ * in floppy_dmabuf */
+static int floppy_write(const struct bio_t *bio) {
+  uint32_t addr = bio->sector << BLOCK_SECTOR_SHIFT;
+  // Cylinder edited in floppy_dmabuf and not saved yet
+  bool edited = false;
+  uint32_t edited_addr = 0;
+  int ret = 0;
+  for (int i = 0; i < bio->nsegs && ret >= 0; i++) {
+    const char *const src = bio->segs[i].buf;
+    uint32_t offset, working_size, done_size = 0;
+    while (bio->segs[i].len > done_size) {
+      uint16_t cyl;
+      addr_2_coff(addr, &cyl, NULL, NULL);
+      if (edited && cyl != floppy_dmacyl) {
+        ret = do_cached(dir_write, edited_addr, NULL, NULL);
+        edited = false;
+        if (ret < 0) break;
+      }
+      // Load cylinder, unless already edited
+      ret = do_cached(dir_read, addr, &offset, &working_size);
+      if (ret < 0) break;
+
+      if (working_size > bio->segs[i].len - done_size) working_size = bio->segs[i].len - done_size;
+      memcpy(&floppy_dmabuf[offset], src + done_size, working_size);
+      edited = true;
+      edited_addr = addr;
+      done_size += working_size;
+      addr += working_size;
+    }
   }
-  return 0;
+  if (edited && ret >= 0) ret = do_cached(dir_write, edited_addr, NULL, NULL);
+  // Buffer no longer matches the disk
+  if (ret < 0) floppy_dmacyl = -1;
+  return ret < 0 ? ret : 0;
 }
 
 bool has_floppy() {
@@ -598,33 +609,22 @@ bool has_floppy() {
   return true;
 }
 
-void floppy_disk_write(void *arg, uint32_t addr, const void *src, size_t n) {
-  (void)arg;
-  int res;
-  (void)res;
-  res = floppy_write(addr, src, n);
-  assert(res >= 0);
-}
-void floppy_disk_read(void *arg, void *dst, uint32_t addr, size_t n) {
-  (void)arg;
-  int res;
-  (void)res;
-  res = floppy_read(dst, addr, n);
-  assert(res >= 0);
-}
-const void *floppy_disk_view(void *arg, uint32_t addr, uint32_t *size) {
-  (void)arg;
-  const void *res = floppy_read_view(addr, size);
-  assert(res);
-  return res;
+static int floppy_serve(struct block_dev_t *dev, struct bio_t *bio) {
+  (void)dev;
+  // One write per cylinder, however many segments it holds
+  if (bio->op == BIO_WRITE) return floppy_write(bio);
+  uint32_t addr = bio->sector << BLOCK_SECTOR_SHIFT;
+  for (int i = 0; i < bio->nsegs; i++) {
+    const int ret = floppy_read(bio->segs[i].buf, addr, bio->segs[i].len);
+    if (ret < 0) return ret;
+    addr += bio->segs[i].len;
+  }
+  return 0;
 }
-bool load_floppy(struct disk_t *d) {
+bool load_floppy(struct block_dev_t *dev) {
   if (!has_floppy())
     return false;
 
-  d->arg = NULL;
-  d->read = floppy_disk_read;
-  d->write = floppy_disk_write;
-  d->view = floppy_disk_view;
+  block_init(dev, FLOPPY_144_SECTORS, floppy_serve, NULL);
   return true;
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #ifndef FLOPPY_H_
 #define FLOPPY_H_
 #include "stdbool.h"
-#include "disk.h"
+#include "block.h"
 
 /** React to floppy disk controller interrupt */
 void floppy_IT();
@@ -9,7 +9,7 @@ void floppy_IT();
 /** Check if some floppy disk is inserted */
 bool has_floppy();
 
-/** Create polymorphic disk for floppy0 if exists */
-bool load_floppy(struct disk_t *);
+/** Setup block device of floppy0 if exists */
+bool load_floppy(struct block_dev_t *);
 
 #endif /*FLOPPY_H_*/
@@ -34,18 +34,20 @@ int cons_read(void) {
   return msg;
 }
 
+/** Keys typed past the length of a line, sent back once it ends. Kept off
+ * the kernel stack, which is smaller */
+static int buf_save[BUFFER_SIZE];
+
 unsigned long cons_readline(char *string, unsigned long length) {
   if (length == 0) return 0;
   int msg;
-  int buf_save[BUFFER_SIZE];
   int buf_idx = 0;
   unsigned long msg_len = 0;
   preceive(keyboard_buffer, &msg);
   while (msg != 13) {
     if (msg == 127) {
       if (msg_len > length) {
-        buf_save[buf_idx] = msg;
-        buf_idx++;
+        if (buf_idx < BUFFER_SIZE) buf_save[buf_idx++] = msg;
       } else if (msg_len > 0) {
         string--;
         *string = '\0';
@@ -54,8 +56,7 @@ unsigned long cons_readline(char *string, unsigned long length) {
         msg_len--;
       }
     } else if (msg_len >= length) {
-      buf_save[buf_idx] = msg;
-      buf_idx++;
+      if (buf_idx < BUFFER_SIZE) buf_save[buf_idx++] = msg;
       msg_len++;
     } else {
       *string = (char)msg;
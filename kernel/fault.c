@@ -0,0 +1,65 @@
+#include "fault.h"
+
+#include "cpu.h"
+#include "file_map.h"
+#include "mm.h"
+#include "scheduler.h"
+#include "segment.h"
+#include "stdio.h"
+#include "user_stack_mem.h"
+
+extern void* const PROC_end_user;
+/** In handlers.S */
+extern void file_map_fill_entry(void);
+
+/** Resume the task saved in t in file_map_fill_entry, on its kernel stack,
+ * to fill the page at addr where it can sleep. It then returns to the
+ * faulting instruction */
+static void defer_fill(struct process_t *ps, struct x86_tss *t, void *addr) {
+  int32_t *sp;
+  if ((t->cs & 3) != 0) {
+    // Kernel stack is unused while in user mode
+    sp = &ps->kernel_stack[NBSTACK - 1];
+    *--sp = t->ss;
+    *--sp = t->esp;
+  } else {
+    sp = (int32_t *)t->esp;
+  }
+  *--sp = t->eflags;
+  *--sp = t->cs;
+  *--sp = t->eip;
+  *--sp = t->ds;
+  *--sp = (int32_t)addr;
+  t->esp = (int)sp;
+  t->eip = (int)file_map_fill_entry;
+  t->cs = KERNEL_CS;
+  t->ss = t->ds = t->es = t->fs = t->gs = KERNEL_DS;
+  // Kernel runs with interrupts disabled
+  t->eflags &= ~0x200;
+}
+
+int page_fault(unsigned error_code, struct x86_tss *t) {
+  void *const addr = (void *)get_cr2();
+  struct process_t *const ps = getproc();
+  // First touch of a stack page
+  if (!(error_code & PF_PRESENT) && user_stack_fault(ps->mm, addr) == 0) return 0;
+  // First touch of a mapped file page, which may need the disk
+  if (!(error_code & PF_PRESENT) && file_map_contains(ps->mm, addr)) {
+    defer_fill(ps, t, addr);
+    return 0;
+  }
+  // First write to a page shared since fork, also from the kernel
+  if ((error_code & PF_PRESENT) && (error_code & PF_WRITE) && mm_cow_fault(ps->mm, addr) == 0) {
+    return 0;
+  }
+  if (!(error_code & PF_USER)) return -1;
+
+  printf("%s (pid %d): segmentation fault at %p (eip %p)\n", ps->name, ps->pid, addr,
+         (void *)t->eip);
+  // Leave through the user exit stub, on top of the process stack as the
+  // fault may come from an overflow
+  t->eip = (int)PROC_end_user;
+  t->eax = RETVAL_SEGFAULT;
+  t->esp = (int)&ps->user_stack[ps->ssize / sizeof(int32_t) - 2];
+  return 0;
+}
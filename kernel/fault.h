@@ -0,0 +1,19 @@
+/*
+ * Page fault resolution.
+ */
+#ifndef __FAULT_H__
+#define __FAULT_H__
+
+#include "boot/processor_structs.h"
+
+/** Page fault error code bits. Cf. 5.12 Intel Architecture Software Developer's Manual Volume 3 */
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+
+/** Try to resolve a page fault of the task saved in t. Faulting user
+ * processes are made to exit with RETVAL_SEGFAULT. Returns -1 on a kernel
+ * fault which cannot be resolved */
+int page_fault(unsigned error_code, struct x86_tss *t);
+
+#endif
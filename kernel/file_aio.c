@@ -0,0 +1,195 @@
+#include "file_aio.h"
+
+#include "file_map.h"
+#include "filesystem.h"
+#include "mm.h"
+#include "paging.h"
+#include "queues.h"
+#include "scheduler.h"
+#include "string.h"
+#include "user_stack_mem.h"
+
+enum file_aio_state {
+  FILE_AIO_FREE,
+  FILE_AIO_QUEUED,
+  FILE_AIO_RUNNING,
+  FILE_AIO_DONE
+};
+
+struct file_aio_t {
+  enum file_aio_state state;
+  int id;
+  /** Requesting process and its address space */
+  int pid;
+  struct mm_t *mm;
+  struct open_file_t *file;
+  bool write;
+  char *buf;
+  size_t offset;
+  size_t len;
+  /** Completion queue or negative */
+  int fid;
+  /** Requesting process stopped: result is not wanted */
+  bool cancelled;
+  int result;
+  /** Completion order */
+  unsigned long done;
+};
+
+static struct file_aio_t requests[FILE_AIO_REQUESTS];
+static int last_id = 0;
+static unsigned long completions = 0;
+/** Indexes of queued requests */
+static int submit_queue = -1;
+static char bounce[FILE_AIO_WORKERS][FILE_AIO_CHUNK];
+
+/** Run in address space mm, NULL for the kernel one. Faults on user
+ * pages are then resolved in mm */
+static void adopt(struct mm_t *mm) {
+  getproc()->mm = mm;
+  mm_switch(mm);
+}
+
+/** Whether [p, p + n) is user memory of mm, writable if write, filling
+ * its stack pages. Does not sleep, unlike filling file pages */
+static bool user_range(struct mm_t *mm, const char *p, size_t n, bool write) {
+  if (n == 0) return true;
+  const uint32_t last = PG_FRAME((uint32_t)p + n - 1);
+  for (uint32_t page = PG_FRAME((uint32_t)p);; page += PAGE_SIZE) {
+    if (!paging_is_user(mm_dir(mm), (void *)page) && user_stack_fault(mm, (void *)page) != 0) {
+      return false;
+    }
+    if (write && !paging_is_user_writable(mm_dir(mm), (void *)page)) return false;
+    if (page == last) return true;
+  }
+}
+
+/** Copy between worker buffer and r's process. Returns -1 if its buffer
+ * is gone */
+static int user_copy(struct file_aio_t *r, char *kbuf, size_t done, size_t n) {
+  adopt(r->mm);
+  // Filling file pages may sleep, while the process unmaps them or stops:
+  // pages are checked after it, then nothing sleeps until the copy ends
+  const bool ok = !r->cancelled && file_map_prefault(r->mm, r->buf + done, n) == 0 &&
+                  !r->cancelled && user_range(r->mm, r->buf + done, n, !r->write);
+  if (ok && r->write) {
+    memcpy(kbuf, r->buf + done, n);
+  } else if (ok) {
+    memcpy(r->buf + done, kbuf, n);
+  }
+  adopt(NULL);
+  return ok ? 0 : -1;
+}
+
+static void complete(struct file_aio_t *r, int result) {
+  fs_file_put(r->file);
+  mm_put(r->mm);
+  if (r->cancelled) {
+    r->state = FILE_AIO_FREE;
+    return;
+  }
+  r->result = result;
+  r->done = ++completions;
+  r->state = FILE_AIO_DONE;
+  // A full queue would hold the worker until its owner receives, which
+  // may never happen: fs_async_poll still reports the request
+  if (r->fid >= 0) ptrysend(r->fid, r->id);
+}
+
+/** Kernel process serving queued requests one chunk at a time */
+static int file_aio_worker(void *arg) {
+  char *const kbuf = bounce[(int)arg];
+  int i;
+  while (preceive(submit_queue, &i) == 0) {
+    if (i < 0 || i >= FILE_AIO_REQUESTS || requests[i].state != FILE_AIO_QUEUED) continue;
+    struct file_aio_t *const r = &requests[i];
+    r->state = FILE_AIO_RUNNING;
+    size_t done = 0;
+    int ret = 0;
+    while (done < r->len && !r->cancelled) {
+      const size_t n = r->len - done < FILE_AIO_CHUNK ? r->len - done : FILE_AIO_CHUNK;
+      if (r->write) {
+        ret = user_copy(r, kbuf, done, n);
+        if (ret == 0) ret = fs_file_write(r->file, r->offset + done, kbuf, n);
+      } else {
+        ret = fs_file_read(r->file, kbuf, r->offset + done, n);
+        if (ret > 0 && user_copy(r, kbuf, done, ret) < 0) ret = -1;
+      }
+      if (ret <= 0) break;
+      done += ret;
+      if ((size_t)ret < n) break;
+    }
+    complete(r, done > 0 ? (int)done : ret);
+  }
+  return 0;
+}
+
+void setup_file_aio(void) {
+  submit_queue = pcreate_kernel(FILE_AIO_REQUESTS);
+  if (submit_queue < 0) return;
+  // Above the shell at prio 1, so disk accesses start as soon as it waits
+  for (int w = 0; w < FILE_AIO_WORKERS; w++) {
+    start_background(file_aio_worker, 512, 2, "file_aio", (void *)w);
+  }
+}
+
+int file_aio_submit(int fd, void *buf, size_t offset, size_t len, int fid, bool write) {
+  struct process_t *const ps = getproc();
+  // Completions go to user queues only
+  if (submit_queue < 0 || ps->mm == NULL || queue_is_kernel(fid)) return -1;
+  struct file_aio_t *r = &requests[0];
+  while (r < &requests[FILE_AIO_REQUESTS] && r->state != FILE_AIO_FREE) r++;
+  if (r == &requests[FILE_AIO_REQUESTS]) return -1;
+  struct open_file_t *const file = fs_file_get(fd);
+  if (file == NULL) return -1;
+
+  last_id = last_id == INT32_MAX ? 1 : last_id + 1;
+  r->state = FILE_AIO_QUEUED;
+  r->id = last_id;
+  r->pid = ps->pid;
+  r->mm = ps->mm;
+  mm_get(r->mm);
+  r->file = file;
+  r->write = write;
+  r->buf = buf;
+  r->offset = offset;
+  r->len = len;
+  r->fid = fid;
+  r->cancelled = false;
+  const int id = r->id;
+  // Never full: it holds every request
+  psend(submit_queue, r - requests);
+  return id;
+}
+
+int file_aio_poll(struct file_completion_t *done, int count) {
+  const int pid = getpid();
+  int n = 0;
+  for (; n < count; n++) {
+    struct file_aio_t *first = NULL;
+    for (int i = 0; i < FILE_AIO_REQUESTS; i++) {
+      struct file_aio_t *const r = &requests[i];
+      if (r->state == FILE_AIO_DONE && r->pid == pid && (first == NULL || r->done < first->done)) {
+        first = r;
+      }
+    }
+    if (first == NULL) break;
+    done[n].id = first->id;
+    done[n].result = first->result;
+    first->state = FILE_AIO_FREE;
+  }
+  return n;
+}
+
+void file_aio_cancel(const struct process_t *ps) {
+  for (int i = 0; i < FILE_AIO_REQUESTS; i++) {
+    struct file_aio_t *const r = &requests[i];
+    if (r->state == FILE_AIO_FREE || r->pid != ps->pid) continue;
+    if (r->state == FILE_AIO_DONE) {
+      r->state = FILE_AIO_FREE;
+    } else {
+      // Freed by its worker
+      r->cancelled = true;
+    }
+  }
+}
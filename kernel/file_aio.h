@@ -0,0 +1,39 @@
+/*
+ * Asynchronous file I/O.
+ *
+ * Requests on open files are queued and served by kernel workers, so a
+ * process keeps running while the disk works. A worker adopts the address
+ * space of the requesting process only while it copies the process buffer
+ * to or from its own, so it never sleeps on the disk holding user memory.
+ * Completions are announced on a message queue of the process, if it gave
+ * one, and collected with file_aio_poll.
+ */
+#ifndef __FILE_AIO_H__
+#define __FILE_AIO_H__
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "file.h"
+
+struct process_t;
+
+/** Requests queued or not collected yet, for all processes */
+#define FILE_AIO_REQUESTS 32
+/** Requests served at the same time */
+#define FILE_AIO_WORKERS 2
+/** Worker buffer size, the largest disk access of a request */
+#define FILE_AIO_CHUNK 4096
+
+void setup_file_aio(void);
+
+/** Transfer len bytes between buf and descriptor fd at offset in the
+ * background. On completion, send the request id to queue fid unless it is
+ * negative or full. Returns request id or -1 */
+int file_aio_submit(int fd, void *buf, size_t offset, size_t len, int fid, bool write);
+/** Move up to count finished requests of the running process to done,
+ * oldest first. Returns their count */
+int file_aio_poll(struct file_completion_t *done, int count);
+/** Drop requests of ps, which is stopping */
+void file_aio_cancel(const struct process_t *ps);
+
+#endif
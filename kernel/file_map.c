@@ -0,0 +1,122 @@
+#include "file_map.h"
+
+#include "filesystem.h"
+#include "frame_mem.h"
+#include "mm.h"
+#include "paging.h"
+#include "scheduler.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdio.h"
+#include "string.h"
+#include "system.h"
+
+static uint32_t page_up(uint32_t addr) {
+  return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static struct mm_file_map_t *find_map(const struct mm_t *mm, const void *addr) {
+  if (mm == NULL) return NULL;
+  for (int i = 0; i < MM_FILE_MAPS; i++) {
+    const struct mm_file_map_t *const map = &mm->maps[i];
+    const uint32_t base = USER_HEAP(map->slot);
+    if (map->length != 0 && (uint32_t)addr >= base && (uint32_t)addr < base + page_up(map->length)) {
+      return (struct mm_file_map_t *)map;
+    }
+  }
+  return NULL;
+}
+
+void *file_map(const FILE *f, uint32_t offset, uint32_t length) {
+  struct mm_t *const mm = getproc()->mm;
+  if (mm == NULL || length == 0 || length > USER_HEAP_SLOT || offset % PAGE_SIZE != 0 ||
+      (f->attribs & FILE_DIRECTORY)) {
+    return (void *)-1;
+  }
+  struct mm_file_map_t *map = NULL;
+  for (int i = 0; i < MM_FILE_MAPS && map == NULL; i++) {
+    if (mm->maps[i].length == 0) map = &mm->maps[i];
+  }
+  const int slot = map != NULL ? mm_heap_slot_alloc(mm) : -1;
+  if (slot < 0) return (void *)-1;
+
+  void *const base = (void *)USER_HEAP(slot);
+  // A forked address space may still map a copy of an older slot here
+  paging_unmap_range(mm_dir(mm), base, (char *)base + USER_HEAP_SLOT);
+  map->file = *f;
+  map->offset = offset;
+  map->slot = slot;
+  map->length = length;
+  return base;
+}
+
+int file_unmap(void *addr) {
+  struct mm_t *const mm = getproc()->mm;
+  struct mm_file_map_t *const map = find_map(mm, addr);
+  if (map == NULL || (uint32_t)addr != USER_HEAP(map->slot)) return -1;
+  paging_unmap_range(mm_dir(mm), addr, (char *)addr + page_up(map->length));
+  mm_heap_slot_free(mm, map->slot);
+  map->length = 0;
+  return 0;
+}
+
+int file_map_contains(const struct mm_t *mm, const void *addr) {
+  return find_map(mm, addr) != NULL;
+}
+
+int file_map_fault(struct mm_t *mm, void *addr) {
+  const struct mm_file_map_t *const map = find_map(mm, addr);
+  if (map == NULL) return -1;
+  uint32_t *const dir = mm_dir(mm);
+  void *const page = (void *)PG_FRAME((uint32_t)addr);
+  if (paging_lookup(dir, page, NULL) != 0) return 0;
+  // Filling reads the file: under the filesystem lock, it would wait on itself
+  if (fs_lock_held()) return -1;
+
+  const uint32_t phys = frame_alloc(0);
+  if (phys == 0) return -1;
+  // Past end of file reads as zeros
+  memset(P2V(phys), 0, PAGE_SIZE);
+  const uint32_t skip = (uint32_t)page - USER_HEAP(map->slot);
+  const uint32_t len = map->length - skip < PAGE_SIZE ? map->length - skip : PAGE_SIZE;
+  const struct mm_file_map_t before = *map;
+  const int read = fs_read(P2V(phys), &before.file, before.offset + skip, len);
+
+  // Mapping may have changed while the disk was read, even to another
+  // file in the same entry and slot
+  const bool same = find_map(mm, addr) == map && map->slot == before.slot &&
+                    map->file.entryAddr == before.file.entryAddr &&
+                    map->offset == before.offset && map->length == before.length;
+  if (read >= 0 && same && paging_lookup(dir, page, NULL) == 0) {
+    if (paging_map(dir, page, phys, PG_USER | PG_COW) == 0) return 0;
+    frame_put(phys);
+    return -1;
+  }
+  frame_put(phys);
+  return read < 0 || find_map(mm, addr) == NULL ? -1 : 0;
+}
+
+int file_map_prefault(struct mm_t *mm, const void *addr, uint32_t length) {
+  if (mm == NULL || length == 0) return 0;
+  const uint32_t start = PG_FRAME((uint32_t)addr);
+  // Up to the end of the address space when length wraps around
+  const uint32_t end = (uint32_t)addr + length - 1 < (uint32_t)addr ? UINT32_MAX : (uint32_t)addr + length - 1;
+  // Only pages of mappings, whatever the range size
+  for (int i = 0; i < MM_FILE_MAPS; i++) {
+    const struct mm_file_map_t *const map = &mm->maps[i];
+    if (map->length == 0) continue;
+    const uint32_t base = USER_HEAP(map->slot);
+    const uint32_t last = base + page_up(map->length) - 1;
+    for (uint32_t page = start > base ? start : base; page <= end && page <= last; page += PAGE_SIZE) {
+      if (file_map_fault(mm, (void *)page) < 0) return -1;
+    }
+  }
+  return 0;
+}
+
+void file_map_fill(void *addr) {
+  struct process_t *const ps = getproc();
+  if (file_map_fault(ps->mm, addr) == 0) return;
+  printf("%s (pid %d): cannot fill mapped file page at %p\n", ps->name, ps->pid, addr);
+  exit(RETVAL_SEGFAULT);
+}
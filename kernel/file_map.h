@@ -0,0 +1,36 @@
+/*
+ * Files mapped in user address spaces.
+ *
+ * A mapping takes a heap slot. Its pages are filled from the buffer cache
+ * on first touch, by the faulting process itself: the page fault task only
+ * sends it to file_map_fill_entry, where it may sleep on the disk. Pages
+ * are copy-on-write, so writes stay private.
+ */
+#ifndef __FILE_MAP_H__
+#define __FILE_MAP_H__
+
+#include "stdint.h"
+#include "file.h"
+
+struct mm_t;
+
+/** Map length bytes of f from offset, a multiple of the page size, in the
+ * running process. Returns mapping address or (void *)-1 */
+void *file_map(const FILE *f, uint32_t offset, uint32_t length);
+/** Remove mapping at addr. Returns -1 if there is none */
+int file_unmap(void *addr);
+
+/** Whether addr is in a file mapping of mm */
+int file_map_contains(const struct mm_t *mm, const void *addr);
+/** Fill the page at addr of a mapping of mm, unless it is already. May
+ * sleep. Returns -1 if addr is not mapped, out of memory, on read error or
+ * inside a filesystem call, as the read would wait for the call to end */
+int file_map_fault(struct mm_t *mm, void *addr);
+/** file_map_fault on every page of [addr, addr + length) in a mapping.
+ * Returns -1 on failure */
+int file_map_prefault(struct mm_t *mm, const void *addr, uint32_t length);
+/** file_map_fault for the running process from file_map_fill_entry,
+ * which exits on failure */
+void file_map_fill(void *addr);
+
+#endif
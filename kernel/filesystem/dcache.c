@@ -0,0 +1,78 @@
+#include "stdbool.h"
+#include "string.h"
+#include "dcache.h"
+
+struct dentry_t {
+  bool used;
+  /** Name is known missing */
+  bool negative;
+  uint32_t parentCluster;
+  char name[FILE_SHORTNAME_SIZE + 1];
+  FILE file;
+  /** Least recently used is replaced */
+  unsigned long lastUse;
+  /** Same hash bucket */
+  struct dentry_t *next;
+};
+
+static struct dentry_t dentries[DCACHE_ENTRIES];
+static struct dentry_t *buckets[DCACHE_HASH];
+static unsigned long uses = 0;
+
+static struct dentry_t **bucket(uint32_t parentCluster, const char *name) {
+  // FNV-1a
+  uint32_t hash = 2166136261u ^ parentCluster;
+  for (; *name; name++) hash = (hash ^ (uint8_t)*name) * 16777619u;
+  return &buckets[hash % DCACHE_HASH];
+}
+
+static struct dentry_t *lookup(uint32_t parentCluster, const char *name) {
+  struct dentry_t *d = *bucket(parentCluster, name);
+  while (d != NULL && (d->parentCluster != parentCluster || strcmp(d->name, name) != 0)) d = d->next;
+  return d;
+}
+
+static void dentry_remove(struct dentry_t *d) {
+  struct dentry_t **p = bucket(d->parentCluster, d->name);
+  while (*p != d) p = &(*p)->next;
+  *p = d->next;
+  d->used = false;
+}
+
+int dcache_get(uint32_t parentCluster, const char *name, FILE *file) {
+  struct dentry_t *const d = lookup(parentCluster, name);
+  if (d == NULL) return -1;
+  d->lastUse = ++uses;
+  if (d->negative) return 0;
+  *file = d->file;
+  return 1;
+}
+
+void dcache_put(uint32_t parentCluster, const char *name, const FILE *file) {
+  // Longer names cannot be stored, nor matched
+  if (strlen(name) > FILE_SHORTNAME_SIZE) return;
+
+  struct dentry_t *d = lookup(parentCluster, name);
+  if (d == NULL) {
+    d = &dentries[0];
+    for (int i = 0; i < DCACHE_ENTRIES && d->used; i++) {
+      if (!dentries[i].used || dentries[i].lastUse < d->lastUse) d = &dentries[i];
+    }
+    if (d->used) dentry_remove(d);
+    d->used = true;
+    d->parentCluster = parentCluster;
+    strcpy(d->name, name);
+    struct dentry_t **const b = bucket(parentCluster, name);
+    d->next = *b;
+    *b = d;
+  }
+  d->negative = file == NULL;
+  if (file != NULL) d->file = *file;
+  d->lastUse = ++uses;
+}
+
+void dcache_invalidate(uint32_t parentCluster) {
+  for (int i = 0; i < DCACHE_ENTRIES; i++) {
+    if (dentries[i].used && dentries[i].parentCluster == parentCluster) dentry_remove(&dentries[i]);
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef DCACHE_H_
+#define DCACHE_H_
+
+#include "file.h"
+
+/** Cached names */
+#define DCACHE_ENTRIES 64
+#define DCACHE_HASH 32
+
+/** Cache of name lookups in directories, including names which do not exist.
+ * Returns 1 and file if found, 0 if known missing, -1 if not cached */
+int dcache_get(uint32_t parentCluster, const char *name, FILE *file);
+/** Remember lookup result, file is NULL if missing */
+void dcache_put(uint32_t parentCluster, const char *name, const FILE *file);
+/** Forget names in directory, after it changed */
+void dcache_invalidate(uint32_t parentCluster);
+
+#endif /*DCACHE_H_*/
@@ -1,4 +1,5 @@
 #include "debug.h"
+#include "mem.h"
 #include "stdbool.h"
 #include "stdint.h"
 #include "string.h"
@@ -70,84 +71,318 @@ enum fat_attr {
 #define ENTRY_AVAILABLE 0x00
 #define ENTRY_ERASED 0xe5
 
-#define WITH_BPB(bpb, d) \
-size_t __bpb_size; \
-const struct bios_block_t *bpb = (struct bios_block_t *)disk_view(d, 0, &__bpb_size); \
-assert(bpb && __bpb_size >= sizeof(struct bios_block_t));
+/** Files with a cached extent map */
+#define FAT_EXTENT_FILES 16
+/** Files growing with unsaved directory entry */
+#define FAT_PENDING_FILES 8
+/** Appends reserve clusters in batches growing with the file, between these */
+#define FAT_PREALLOC_CLUSTERS 8
+#define FAT_PREALLOC_MAX 64
+
+/** Contiguous clusters of a file */
+struct fat_extent_t {
+  /** Index of first cluster in file */
+  uint32_t logical;
+  uint16_t clusterIndex;
+  uint16_t length;
+};
 
-uint32_t fat_get_total_sector_count(struct disk_t *d) {
-  WITH_BPB(bpb, d);
-  if (bpb->sectorCount) {
-    return bpb->sectorCount;
-  } else {
-    return bpb->largeSectorCount;
+/** Cluster chain of a file as sorted extents */
+struct fat_extents_t {
+  /** First cluster of file, 0 if unused */
+  uint16_t clusterIndex;
+  uint32_t count;
+  struct fat_extent_t *runs;
+  /** Least recently used is replaced */
+  unsigned long lastUse;
+};
+
+/** File written since last flush. Its directory entry and the FAT are
+ * saved by fat_pending_flush, which releases clusters reserved past size */
+struct fat_pending_t {
+  /** Directory entry, 0 if unused */
+  addr_t entryAddr;
+  uint16_t clusterIndex;
+  uint32_t size;
+  /** Allocated clusters, including reserved ones */
+  uint32_t clusters;
+  uint16_t lastCluster;
+  /** Least recently used is flushed first */
+  unsigned long lastUse;
+};
+
+/** Mounted volume, in filesystem_t arg */
+struct fat_t {
+  struct disk_t *disk;
+  /** Geometry computed from the BPB at mount */
+  uint32_t bytesPerSector;
+  uint32_t bytesPerCluster;
+  uint32_t fatCount;
+  uint32_t rootEntryCount;
+  /** Data clusters, numbered from 2 */
+  uint32_t clusterCount;
+  /** First FAT copy, root directory and data area */
+  addr_t fatAddr;
+  addr_t rootAddr;
+  addr_t dataAddr;
+  /** Bytes per FAT copy */
+  uint32_t fatSize;
+  /** First FAT copy */
+  uint16_t *table;
+  /** Table sectors changed since last flush, one bit each */
+  uint32_t *dirty;
+  /** Free clusters, one bit each, kept in sync with table */
+  uint32_t *freeMap;
+  uint32_t freeCount;
+  /** Next fit: search starts after the last allocation */
+  uint32_t nextFree;
+  /** Extent maps by first cluster */
+  struct fat_extents_t extents[FAT_EXTENT_FILES];
+  unsigned long extentUses;
+  struct fat_pending_t pending[FAT_PENDING_FILES];
+  unsigned long pendingUses;
+};
+
+#define FAT(fs) ((struct fat_t *)(fs)->arg)
+
+static void fat_mount(struct fat_t *fat, struct disk_t *d, const struct bios_block_t *bpb) {
+  fat->disk = d;
+  fat->bytesPerSector = bpb->bytesPerSector;
+  fat->bytesPerCluster = bpb->sectorsPerCluster * bpb->bytesPerSector;
+  fat->fatCount = bpb->fatCount;
+  fat->rootEntryCount = bpb->rootEntryCount;
+  fat->fatSize = bpb->sectorsPerFat * bpb->bytesPerSector;
+  fat->fatAddr = bpb->reservedSectorCount * bpb->bytesPerSector;
+  fat->rootAddr = fat->fatAddr + fat->fatCount * fat->fatSize;
+  fat->dataAddr = fat->rootAddr + fat->rootEntryCount * sizeof(struct dir_entry_t);
+
+  const uint32_t totalSectorCount = bpb->sectorCount ? bpb->sectorCount : bpb->largeSectorCount;
+  const uint32_t dataSectorCount = totalSectorCount - fat->dataAddr / bpb->bytesPerSector;
+  fat->clusterCount = dataSectorCount / bpb->sectorsPerCluster;
+  // Entries past the table cannot be used
+  if (fat->clusterCount + 2 > fat->fatSize / sizeof(uint16_t)) {
+    fat->clusterCount = fat->fatSize / sizeof(uint16_t) - 2;
   }
+
+  const uint32_t sectors = bpb->sectorsPerFat;
+  fat->table = mem_alloc(fat->fatSize);
+  fat->dirty = mem_alloc((sectors + 31) / 32 * sizeof(uint32_t));
+  fat->freeMap = mem_alloc((fat->clusterCount + 2 + 31) / 32 * sizeof(uint32_t));
+  assert(fat->table && fat->dirty && fat->freeMap);
+  memset(fat->dirty, 0, (sectors + 31) / 32 * sizeof(uint32_t));
+  memset(fat->extents, 0, sizeof(fat->extents));
+  fat->extentUses = 0;
+  memset(fat->pending, 0, sizeof(fat->pending));
+  fat->pendingUses = 0;
 }
-uint32_t fat_get_meta_sector_count(struct disk_t *d) {
-  WITH_BPB(bpb, d);
-  return bpb->reservedSectorCount + bpb->fatCount * bpb->sectorsPerFat +
-         (bpb->rootEntryCount * sizeof(struct dir_entry_t)) / bpb->bytesPerSector;
+
+/** End of valid cluster indexes */
+static uint32_t fat_cluster_end(const struct fat_t *fat) { return fat->clusterCount + 2; }
+
+static bool fat_is_free(const struct fat_t *fat, uint32_t clusterIndex) {
+  return fat->freeMap[clusterIndex / 32] & (1u << (clusterIndex % 32));
 }
-uint32_t fat_get_cluster_count(struct disk_t* d) {
-  uint32_t totalSectorCount = fat_get_total_sector_count(d);
-  uint32_t metaSectorCount = fat_get_meta_sector_count(d);
-  uint32_t dataSectorCount = totalSectorCount - metaSectorCount;
 
-  WITH_BPB(bpb, d);
-  return dataSectorCount / bpb->sectorsPerCluster;
+/** Build free map from the loaded table */
+static void fat_build_free_map(struct fat_t *fat) {
+  memset(fat->freeMap, 0, (fat_cluster_end(fat) + 31) / 32 * sizeof(uint32_t));
+  fat->freeCount = 0;
+  for (uint32_t clusterIndex = 2; clusterIndex < fat_cluster_end(fat); clusterIndex++) {
+    if (fat->table[clusterIndex] == 0) {
+      fat->freeMap[clusterIndex / 32] |= 1u << (clusterIndex % 32);
+      fat->freeCount++;
+    }
+  }
+  fat->nextFree = 2;
 }
 
-addr_t fat_get_root_table_addr(struct disk_t *d) {
-  WITH_BPB(bpb, d);
-  return (bpb->reservedSectorCount + 0 * bpb->sectorsPerFat) *
-                    bpb->bytesPerSector;
+addr_t fat_get_cluster_addr(struct fat_t *fat, uint32_t clusterIndex) {
+  if (clusterIndex < 2) return fat->rootAddr;
+  return fat->dataAddr + (clusterIndex - 2) * fat->bytesPerCluster;
 }
 
-addr_t fat_get_cluster_addr(struct disk_t *d, uint32_t clusterIndex) {
-  WITH_BPB(bpb, d);
-  uint32_t fatOffset =
-      (bpb->reservedSectorCount + bpb->fatCount * bpb->sectorsPerFat) *
-      bpb->bytesPerSector;
-  if (clusterIndex < 2) return fatOffset;
-  return fatOffset + bpb->rootEntryCount * sizeof(struct dir_entry_t) +
-         (clusterIndex - 2) * (bpb->sectorsPerCluster * bpb->bytesPerSector);
+uint16_t fat_get_cluster_value(struct fat_t *fat, uint32_t clusterIndex) {
+  assert(clusterIndex < fat_cluster_end(fat));
+  return fat->table[clusterIndex];
+}
+void fat_set_cluster_value(struct fat_t *fat, uint32_t clusterIndex, uint16_t value) {
+  assert(clusterIndex < fat_cluster_end(fat));
+  if (clusterIndex >= 2 && (fat->table[clusterIndex] == 0) != (value == 0)) {
+    fat->freeMap[clusterIndex / 32] ^= 1u << (clusterIndex % 32);
+    if (value == 0) {
+      fat->freeCount++;
+    } else {
+      fat->freeCount--;
+    }
+  }
+  fat->table[clusterIndex] = value;
+  const uint32_t sector = clusterIndex * sizeof(uint16_t) / fat->bytesPerSector;
+  fat->dirty[sector / 32] |= 1u << (sector % 32);
 }
 
-uint16_t fat_get_cluster_value(struct disk_t *d, uint32_t clusterIndex) {
-  uint32_t fatOffset = fat_get_root_table_addr(d);
-  assert(clusterIndex < fat_get_cluster_count(d));
-  uint16_t value;
-  disk_read(d, &value, fatOffset + clusterIndex * sizeof(value), sizeof(value));
-  return value;
+/** Write dirty table sectors to every FAT copy, one write per contiguous range */
+void fat_flush(struct fat_t *fat) {
+  const uint32_t sectors = fat->fatSize / fat->bytesPerSector;
+  uint32_t sector = 0;
+  while (sector < sectors) {
+    if (!(fat->dirty[sector / 32] & (1u << (sector % 32)))) {
+      sector++;
+      continue;
+    }
+    const uint32_t first = sector;
+    while (sector < sectors && (fat->dirty[sector / 32] & (1u << (sector % 32)))) {
+      fat->dirty[sector / 32] &= ~(1u << (sector % 32));
+      sector++;
+    }
+    const uint32_t offset = first * fat->bytesPerSector;
+    const uint32_t len = (sector - first) * fat->bytesPerSector;
+    for (uint32_t fatIndex = 0; fatIndex < fat->fatCount; fatIndex++) {
+      disk_write(fat->disk, fat->fatAddr + fatIndex * fat->fatSize + offset,
+                 (const char *)fat->table + offset, len);
+    }
+  }
 }
-void fat_set_cluster_value(struct disk_t *d, uint32_t clusterIndex, uint16_t value) {
-  uint32_t fatOffset = fat_get_root_table_addr(d);
-  assert(clusterIndex < fat_get_cluster_count(d));
-  disk_write(d, fatOffset + clusterIndex * sizeof(value), &value, sizeof(value));
+
+/** Length of the free run at clusterIndex, up to max */
+static uint32_t fat_free_run(const struct fat_t *fat, uint32_t clusterIndex, uint32_t max) {
+  uint32_t len = 0;
+  while (len < max && clusterIndex + len < fat_cluster_end(fat) && fat_is_free(fat, clusterIndex + len)) {
+    len++;
+  }
+  return len;
 }
 
-uint16_t fat_find_free_cluster(struct disk_t *d) {
-  uint32_t clusterCount = fat_get_cluster_count(d);
-  uint32_t fatOffset = fat_get_root_table_addr(d);
+/** Allocate up to count contiguous clusters chained together, the last one
+ * ending the chain. Next fit returns the first run of count clusters after
+ * the previous allocation, or else the longest run. Returns first cluster,
+ * and run length in len, or 0 if disk is full */
+uint16_t fat_alloc_run(struct fat_t *fat, uint32_t count, uint32_t *len) {
+  if (fat->freeCount == 0 || count == 0) return 0;
+
+  uint32_t best = 0, bestLen = 0;
+  uint32_t clusterIndex = fat->nextFree;
+  for (uint32_t seen = 0; seen < fat->clusterCount && bestLen < count;) {
+    if (clusterIndex >= fat_cluster_end(fat)) clusterIndex = 2;
+    // Skip full words at once
+    if ((clusterIndex % 32) == 0 && fat->freeMap[clusterIndex / 32] == 0) {
+      const uint32_t skip = fat_cluster_end(fat) - clusterIndex;
+      seen += skip < 32 ? skip : 32;
+      clusterIndex += 32;
+      continue;
+    }
+    if (!fat_is_free(fat, clusterIndex)) {
+      seen++;
+      clusterIndex++;
+      continue;
+    }
+    const uint32_t run = fat_free_run(fat, clusterIndex, count);
+    if (run > bestLen) {
+      best = clusterIndex;
+      bestLen = run;
+    }
+    seen += run;
+    clusterIndex += run;
+  }
+  if (bestLen == 0) return 0;
 
-  for (uint32_t clusterIndex = 2; clusterIndex < clusterCount; ++clusterIndex) {
-    uint16_t data;
-    disk_read(d, &data, fatOffset + clusterIndex * sizeof(data), sizeof(data));
-    if (data == 0) return clusterIndex;
+  const uint16_t endOfChainValue = fat_get_cluster_value(fat, 1);
+  for (uint32_t i = 0; i < bestLen; i++) {
+    fat_set_cluster_value(fat, best + i, i + 1 < bestLen ? best + i + 1 : endOfChainValue);
   }
+  fat->nextFree = best + bestLen;
+  *len = bestLen;
+  return best;
+}
 
-  return 0;
+void fat_update_cluster(struct fat_t *fat, uint32_t clusterIndex, uint16_t value) {
+  // Mirrored to all copies by fat_flush
+  fat_set_cluster_value(fat, clusterIndex, value);
+}
+
+/** Chain end marker or invalid link */
+static bool fat_is_chain_end(const struct fat_t *fat, uint32_t value) {
+  return value < 2 || value >= fat_cluster_end(fat);
+}
+
+/** Drop extent map of chain starting at clusterIndex, after it changed */
+void fat_extents_invalidate(struct fat_t *fat, uint32_t clusterIndex) {
+  for (int i = 0; i < FAT_EXTENT_FILES; i++) {
+    struct fat_extents_t *const e = &fat->extents[i];
+    if (e->clusterIndex == clusterIndex && e->clusterIndex != 0) {
+      mem_free(e->runs, e->count * sizeof(struct fat_extent_t));
+      e->clusterIndex = 0;
+    }
+  }
 }
 
-void fat_update_cluster(struct disk_t *d, uint32_t clusterIndex, uint16_t value) {
-  WITH_BPB(bpb, d);
-  uint8_t fatCount = bpb->fatCount;
-  for (uint32_t fatIndex = 0; fatIndex < fatCount; fatIndex++) {
-    fat_set_cluster_value(d, clusterIndex, value);
+/** Extent map of chain starting at clusterIndex, built on first use.
+ * Returns NULL if out of memory */
+struct fat_extents_t *fat_extents(struct fat_t *fat, uint32_t clusterIndex) {
+  struct fat_extents_t *victim = &fat->extents[0];
+  for (int i = 0; i < FAT_EXTENT_FILES; i++) {
+    struct fat_extents_t *const e = &fat->extents[i];
+    if (e->clusterIndex == clusterIndex) {
+      e->lastUse = ++fat->extentUses;
+      return e;
+    }
+    if (victim->clusterIndex != 0 && (e->clusterIndex == 0 || e->lastUse < victim->lastUse)) {
+      victim = e;
+    }
+  }
+  if (victim->clusterIndex != 0) fat_extents_invalidate(fat, victim->clusterIndex);
+
+  // Count runs then fill them. The loop bound stops on cycles
+  uint32_t count = 0;
+  uint32_t prev = 0;
+  uint32_t clusters = 0;
+  for (uint32_t c = clusterIndex; !fat_is_chain_end(fat, c) && clusters < fat->clusterCount;
+       c = fat->table[c], clusters++) {
+    if (c != prev + 1 || clusters == 0) count++;
+    prev = c;
+  }
+  // Invalid first cluster
+  if (count == 0) return NULL;
+  struct fat_extent_t *const runs = mem_alloc(count * sizeof(struct fat_extent_t));
+  if (runs == NULL) return NULL;
+
+  uint32_t n = 0;
+  clusters = 0;
+  for (uint32_t c = clusterIndex; !fat_is_chain_end(fat, c) && clusters < fat->clusterCount;
+       c = fat->table[c], clusters++) {
+    if (n > 0 && c == runs[n - 1].clusterIndex + runs[n - 1].length) {
+      runs[n - 1].length++;
+    } else {
+      runs[n].logical = clusters;
+      runs[n].clusterIndex = c;
+      runs[n].length = 1;
+      n++;
+    }
   }
+
+  victim->clusterIndex = clusterIndex;
+  victim->count = n;
+  victim->runs = runs;
+  victim->lastUse = ++fat->extentUses;
+  return victim;
 }
 
-bool fat_format(struct disk_t *d, struct bios_block_t *bpb) {
+/** Extent holding logical cluster, or count if past the end */
+static uint32_t fat_extent_find(const struct fat_extents_t *e, uint32_t logical) {
+  uint32_t low = 0, high = e->count;
+  while (low < high) {
+    const uint32_t mid = (low + high) / 2;
+    if (logical < e->runs[mid].logical) {
+      high = mid;
+    } else if (logical >= e->runs[mid].logical + e->runs[mid].length) {
+      low = mid + 1;
+    } else {
+      return mid;
+    }
+  }
+  return e->count;
+}
+
+bool fat_format(struct fat_t *fat, struct disk_t *d, struct bios_block_t *bpb) {
   uint8_t *boot_sector = (uint8_t*)bpb;
   // Validate signature
   if (boot_sector[0x1fe] != 0x55 || boot_sector[0x1ff] != 0xaa) {
@@ -156,41 +391,68 @@ bool fat_format(struct disk_t *d, struct bios_block_t *bpb) {
 
   // Copy to sector 0
   disk_write(d, 0, boot_sector, bpb->bytesPerSector);
+  fat_mount(fat, d, bpb);
 
   // Initialize clusters
-  uint32_t clusterCount = fat_get_cluster_count(d);
-  assert(clusterCount >= 2);
-
-  fat_update_cluster(d, 0, 0xff00 | bpb->mediaType);  // media type
-  fat_update_cluster(d, 1, 0xffff);  // end of chain cluster marker
-
-  for (uint32_t clusterIndex = 2; clusterIndex < clusterCount; ++clusterIndex) {
-    fat_update_cluster(d, clusterIndex, 0x0000);
+  assert(fat->clusterCount >= 2);
+  memset(fat->table, 0, fat->fatSize);
+  for (uint32_t sector = 0; sector < fat->fatSize / fat->bytesPerSector; sector++) {
+    fat->dirty[sector / 32] |= 1u << (sector % 32);
+  }
+  fat_update_cluster(fat, 0, 0xff00 | bpb->mediaType);  // media type
+  fat_update_cluster(fat, 1, 0xffff);  // end of chain cluster marker
+  fat_flush(fat);
+  fat_build_free_map(fat);
+
+  // Empty root directory
+  uint8_t zeros[SECTOR_SIZE];
+  memset(zeros, ENTRY_AVAILABLE, sizeof(zeros));
+  for (addr_t addr = fat->rootAddr; addr < fat->dataAddr; addr += sizeof(zeros)) {
+    const uint32_t len = fat->dataAddr - addr;
+    disk_write(d, addr, zeros, len < sizeof(zeros) ? len : sizeof(zeros));
   }
 
   return true;
 }
 
-addr_t fat_find_entry(struct disk_t *d, uint32_t clusterIndex, bool free, int32_t skip, int32_t* index) {
-  WITH_BPB(bpb, d);
-  uint16_t rootEntryCount = bpb->rootEntryCount;
-
-  uint32_t start = fat_get_cluster_addr(d, clusterIndex);
-
-  for (int32_t offset = skip; offset < rootEntryCount; offset++) {
-    struct dir_entry_t *entry = (struct dir_entry_t *)disk_view( d,
-        start + offset * sizeof(struct dir_entry_t) +
-            offsetof(struct dir_entry_t, name), NULL);
-    if (free ^ (entry->name[0] != ENTRY_AVAILABLE && entry->name[0] != ENTRY_ERASED)) {
-      if (index) *index = offset;
-      return start + offset * sizeof(struct dir_entry_t);
+/** Entry at cursor, which moves to the next one. Returns 0 at the end of
+ * directory. Subdirectories follow their cluster chain */
+static addr_t fat_cursor_next(struct fat_t *fat, DIR_CURSOR *c) {
+  if (c->done) return 0;
+  if (c->cluster == 0) {
+    // Root directory has its own area
+    if (c->entry < fat->rootEntryCount) return fat->rootAddr + c->entry++ * sizeof(struct dir_entry_t);
+  } else if (!fat_is_chain_end(fat, c->cluster) &&
+             c->entry <= fat->bytesPerCluster / sizeof(struct dir_entry_t)) {
+    if (c->entry == fat->bytesPerCluster / sizeof(struct dir_entry_t)) {
+      c->cluster = fat->table[c->cluster];
+      c->entry = 0;
+    }
+    if (!fat_is_chain_end(fat, c->cluster)) {
+      return fat_get_cluster_addr(fat, c->cluster) + c->entry++ * sizeof(struct dir_entry_t);
     }
   }
-
+  c->done = 1;
   return 0;
 }
-addr_t fat_find_free_entry(struct disk_t *d, uint32_t clusterIndex) {
-  return fat_find_entry(d, clusterIndex, true, 0, NULL);
+
+static void fat_cursor_start(DIR_CURSOR *c, const DIR dir) {
+  c->dir = dir;
+  c->cluster = dir.clusterIndex;
+  c->entry = 0;
+  c->done = 0;
+}
+
+addr_t fat_find_free_entry(struct fat_t *fat, uint32_t clusterIndex) {
+  DIR_CURSOR c;
+  fat_cursor_start(&c, (DIR){.clusterIndex = clusterIndex});
+  addr_t addr;
+  while ((addr = fat_cursor_next(fat, &c))) {
+    uint8_t first;
+    disk_read(fat->disk, &first, addr + offsetof(struct dir_entry_t, name), sizeof(first));
+    if (first == ENTRY_AVAILABLE || first == ENTRY_ERASED) return addr;
+  }
+  return 0;
 }
 
 static int toupper(int c) {
@@ -238,51 +500,76 @@ void fat_split_path(uint8_t dstName[8], uint8_t dstExt[3], const char *path) {
   set_padded_string(dstName, 8, name, nameLen);
   set_padded_string(dstExt, 3, ext, extLen);
 }
+/** Whether name fits a short entry as is: fat_split_path would cut it.
+ * Long names would need long name entries */
+static bool fat_is_short_name(const char *name) {
+  const char *const dot = strchr(name, '.');
+  const size_t nameLen = dot ? (size_t)(dot - name) : strlen(name);
+  if (nameLen == 0 || nameLen > 8) return false;
+  if (dot && (strlen(dot + 1) > 3 || strchr(dot + 1, '.') != NULL)) return false;
+  for (const char *c = name; *c; c++) {
+    if (*c != '.' && ((unsigned char)*c <= ' ' || strchr("\"*+,/:;<=>?[\\]|", *c) != NULL)) {
+      return false;
+    }
+  }
+  return true;
+}
 
-void fat_update_dir_entry(struct disk_t* d, addr_t addr, uint16_t clusterIndex, const uint8_t name[8], const uint8_t ext[3], uint32_t fileSize) {
-  struct dir_entry_t *entry = (struct dir_entry_t *)disk_view(d, addr, NULL);
-  entry->clusterIndex = clusterIndex;
-  memcpy(entry->name, name, sizeof((struct dir_entry_t){0}).name);
-  memcpy(entry->ext, ext, sizeof((struct dir_entry_t){0}).ext);
-  entry->fileSize = fileSize;
+void fat_update_dir_entry(struct fat_t *fat, addr_t addr, uint16_t clusterIndex, const uint8_t name[8], const uint8_t ext[3], uint32_t fileSize) {
+  // Views are read only: a cached disk would not know the block changed
+  struct dir_entry_t entry;
+  disk_read(fat->disk, &entry, addr, sizeof(entry));
+  entry.clusterIndex = clusterIndex;
+  memcpy(entry.name, name, sizeof(entry.name));
+  memcpy(entry.ext, ext, sizeof(entry.ext));
+  entry.fileSize = fileSize;
+  disk_write(fat->disk, addr, &entry, sizeof(entry));
 }
-void fat_remove_dir_entry(struct disk_t* d, addr_t addr) {
-  const char available = ENTRY_AVAILABLE;
-  disk_write(d, addr + offsetof(struct dir_entry_t, name), &available, sizeof(available));
+void fat_remove_dir_entry(struct fat_t *fat, addr_t addr) {
+  struct dir_entry_t entry;
+  disk_read(fat->disk, &entry, addr, sizeof(entry));
+  // Available would end the directory for other systems. The freed chain
+  // must not be reachable from the erased entry
+  entry.name[0] = ENTRY_ERASED;
+  entry.clusterIndex = 0;
+  entry.fileSize = 0;
+  disk_write(fat->disk, addr, &entry, sizeof(entry));
 }
 
-void fat_remove_data(struct disk_t *d, uint32_t fatIndex, uint32_t clusterIndex) {
+void fat_remove_data(struct fat_t *fat, uint32_t fatIndex, uint32_t clusterIndex) {
   assert(clusterIndex != 0);
+  fat_extents_invalidate(fat, clusterIndex);
 
-  uint16_t endOfChainValue = fat_get_cluster_value(d, 1);
-  while (clusterIndex != endOfChainValue) {
-    uint16_t nextClusterIndex = fat_get_cluster_value(d, clusterIndex);
-    fat_update_cluster(d, clusterIndex, fatIndex);
+  // Any end marker ends the chain, not only ours. The loop bound stops on cycles
+  for (uint32_t clusters = 0; !fat_is_chain_end(fat, clusterIndex) && clusters < fat->clusterCount;
+       clusters++) {
+    uint16_t nextClusterIndex = fat_get_cluster_value(fat, clusterIndex);
+    fat_update_cluster(fat, clusterIndex, fatIndex);
     clusterIndex = nextClusterIndex;
   }
+  fat_flush(fat);
 }
-uint16_t fat_add_data(struct disk_t *d, uint32_t fatIndex, const void *data, uint32_t len) {
-  WITH_BPB(bpb, d);
-  uint32_t bytesPerCluster = bpb->sectorsPerCluster * bpb->bytesPerSector;
+uint16_t fat_add_data(struct fat_t *fat, uint32_t fatIndex, const void *data, uint32_t len) {
+  uint32_t bytesPerCluster = fat->bytesPerCluster;
 
   // Skip empty files
   if (len == 0) return 0;
 
-  uint16_t endOfChainValue = fat_get_cluster_value(d, 1);
-
   uint16_t prevClusterIndex = 0;
   uint16_t rootClusterIndex = 0;
 
-  // Copy data one cluster at a time.
+  // Copy data one run of contiguous clusters at a time.
   const uint8_t *p = (const uint8_t *)data;
   const uint8_t *end = p + len;
   while (p < end) {
-    // Find a free cluster
-    uint16_t clusterIndex = fat_find_free_cluster(d);
+    // Allocate remaining clusters
+    uint32_t runLength;
+    const uint32_t needed = (end - p + bytesPerCluster - 1) / bytesPerCluster;
+    uint16_t clusterIndex = fat_alloc_run(fat, needed, &runLength);
     if (clusterIndex == 0) {
       // Ran out of disk space, free allocated clusters
       if (rootClusterIndex != 0) {
-        fat_remove_data(d, fatIndex, rootClusterIndex);
+        fat_remove_data(fat, fatIndex, rootClusterIndex);
       }
 
       return 0;
@@ -290,94 +577,73 @@ uint16_t fat_add_data(struct disk_t *d, uint32_t fatIndex, const void *data, uin
 
     // Determine amount of data to copy
     uint32_t count = end - p;
-    if (count > bytesPerCluster) count = bytesPerCluster;
+    if (count > runLength * bytesPerCluster) count = runLength * bytesPerCluster;
 
-    // Transfer bytes into image at cluster location
-    uint32_t offset = fat_get_cluster_addr(d, clusterIndex);
-    disk_write(d, offset, p, count);
+    // Transfer bytes into image at run location
+    uint32_t offset = fat_get_cluster_addr(fat, clusterIndex);
+    disk_write(fat->disk, offset, p, count);
     p += count;
 
-    // Update FAT clusters
-    fat_update_cluster(d, clusterIndex, endOfChainValue);
+    // Link run after previous one
     if (prevClusterIndex) {
-      fat_update_cluster(d, prevClusterIndex, clusterIndex);
+      fat_update_cluster(fat, prevClusterIndex, clusterIndex);
     } else {
       rootClusterIndex = clusterIndex;
     }
 
-    prevClusterIndex = clusterIndex;
+    prevClusterIndex = clusterIndex + runLength - 1;
   }
 
+  fat_flush(fat);
   return rootClusterIndex;
 }
-int fat_read_data(struct disk_t *d, uint32_t clusterIndex, void* data, uint32_t len, size_t skip) {
+/** Copy len bytes at offset skip in the chain starting at clusterIndex,
+ * one disk access per extent */
+static int fat_transfer_data(struct fat_t *fat, uint32_t clusterIndex, void *data, uint32_t len, size_t skip, bool write) {
   assert(clusterIndex != 0);
-  WITH_BPB(bpb, d);
-  uint32_t bytesPerCluster = bpb->sectorsPerCluster * bpb->bytesPerSector;
+  uint32_t bytesPerCluster = fat->bytesPerCluster;
 
   // Skip empty files
   if (len == 0) return 0;
 
-  uint16_t endOfChainValue = fat_get_cluster_value(d, 1);
-  uint32_t read_size = 0;
-  uint8_t *p = (uint8_t *)data;
-
-  // Copy data one cluster at a time.
-  while (clusterIndex != endOfChainValue && len > (uint32_t)(p-(uint8_t*)data)) {
-    if (read_size + bytesPerCluster > skip) {
-      // Determine amount of data to copy
-      uint32_t start = read_size > skip ? 0 : skip - read_size;
-      uint32_t count = len - (p-(uint8_t*)data);
-      if (count > bytesPerCluster) count = bytesPerCluster;
+  const struct fat_extents_t *const e = fat_extents(fat, clusterIndex);
+  if (e == NULL) return -1;
 
-      // Transfer bytes into image at cluster location
-      uint32_t offset = fat_get_cluster_addr(d, clusterIndex);
-      disk_read(d, p, offset+start, count);
-      p += count;
-    }
-    read_size += bytesPerCluster;
-    clusterIndex = fat_get_cluster_value(d, clusterIndex);
-  }
-  return p - (uint8_t *)data;
-}
-int fat_write_data(struct disk_t *d, uint32_t clusterIndex, const void* data, uint32_t len, size_t skip) {
-  assert(clusterIndex != 0);
-  WITH_BPB(bpb, d);
-  uint32_t bytesPerCluster = bpb->sectorsPerCluster * bpb->bytesPerSector;
-
-  // Skip empty files
-  if (len == 0) return 0;
-
-  uint16_t endOfChainValue = fat_get_cluster_value(d, 1);
-  uint32_t read_size = 0;
   uint8_t *p = (uint8_t *)data;
+  uint32_t run = fat_extent_find(e, skip / bytesPerCluster);
+  uint32_t start = run < e->count ? skip - e->runs[run].logical * bytesPerCluster : 0;
+  for (; run < e->count && len > (uint32_t)(p - (uint8_t *)data); run++, start = 0) {
+    // Determine amount of data to copy
+    uint32_t count = len - (p - (uint8_t *)data);
+    if (count > e->runs[run].length * bytesPerCluster - start) {
+      count = e->runs[run].length * bytesPerCluster - start;
+    }
 
-  // Copy data one cluster at a time.
-  while (clusterIndex != endOfChainValue && len > (uint32_t)(p-(uint8_t*)data)) {
-    if (read_size + bytesPerCluster > skip) {
-      // Determine amount of data to copy
-      uint32_t start = read_size > skip ? 0 : skip - read_size;
-      uint32_t count = len - (p-(uint8_t*)data);
-      if (count > bytesPerCluster) count = bytesPerCluster;
-
-      // Transfer bytes into image at cluster location
-      uint32_t offset = fat_get_cluster_addr(d, clusterIndex);
-      disk_write(d, offset+start, p, count);
-      p += count;
+    // Transfer bytes from image at extent location
+    uint32_t offset = fat_get_cluster_addr(fat, e->runs[run].clusterIndex) + start;
+    if (write) {
+      disk_write(fat->disk, offset, p, count);
+    } else {
+      disk_read(fat->disk, p, offset, count);
     }
-    read_size += bytesPerCluster;
-    clusterIndex = fat_get_cluster_value(d, clusterIndex);
+    p += count;
   }
   return p - (uint8_t *)data;
 }
+int fat_read_data(struct fat_t *fat, uint32_t clusterIndex, void* data, uint32_t len, size_t skip) {
+  return fat_transfer_data(fat, clusterIndex, data, len, skip, false);
+}
+int fat_write_data(struct fat_t *fat, uint32_t clusterIndex, const void* data, uint32_t len, size_t skip) {
+  return fat_transfer_data(fat, clusterIndex, (void *)data, len, skip, true);
+}
 
-addr_t fat_add_file(struct disk_t* d, uint32_t clusterIndex, uint32_t fatIndex, const char *path, const void *data, uint32_t size) {
+addr_t fat_add_file(struct fat_t *fat, uint32_t clusterIndex, uint32_t fatIndex, const char *path, const void *data, uint32_t size) {
   // Find Directory Entry
-  addr_t entry = fat_find_free_entry(d, clusterIndex);
+  addr_t entry = fat_find_free_entry(fat, clusterIndex);
   if (!entry) return 0;
 
   // Add File
-  uint16_t rootClusterIndex = fat_add_data(d, fatIndex, data, size);
+  uint16_t rootClusterIndex = fat_add_data(fat, fatIndex, data, size);
   if (!rootClusterIndex) return 0;
 
   // Update Directory Entry
@@ -385,14 +651,167 @@ addr_t fat_add_file(struct disk_t* d, uint32_t clusterIndex, uint32_t fatIndex,
   uint8_t ext[3];
   fat_split_path(name, ext, path);
 
-  fat_update_dir_entry(d, entry, rootClusterIndex, name, ext, size);
+  fat_update_dir_entry(fat, entry, rootClusterIndex, name, ext, size);
   return entry;
 }
-void fat_remove_file(struct disk_t *d, addr_t addr) {
+void fat_remove_file(struct fat_t *fat, addr_t addr) {
   uint16_t clusterIndex;
-  disk_read(d, &clusterIndex, addr + offsetof(struct dir_entry_t, clusterIndex), sizeof(clusterIndex));
-  fat_remove_data(d, 0, clusterIndex);
-  fat_remove_dir_entry(d, addr);
+  disk_read(fat->disk, &clusterIndex, addr + offsetof(struct dir_entry_t, clusterIndex), sizeof(clusterIndex));
+  fat_remove_data(fat, 0, clusterIndex);
+  fat_remove_dir_entry(fat, addr);
+}
+
+/** Read directory entry at an address given by user. Returns whether it
+ * is a file or directory in use, not a free, erased or long name entry */
+static bool fat_user_entry(const struct fat_t *fat, addr_t addr, struct dir_entry_t *entry) {
+  if (addr < fat->rootAddr || (addr - fat->rootAddr) % sizeof(struct dir_entry_t) != 0 ||
+      addr >= fat->dataAddr + fat->clusterCount * fat->bytesPerCluster) {
+    return false;
+  }
+  disk_read(fat->disk, entry, addr, sizeof(*entry));
+  return entry->name[0] != ENTRY_AVAILABLE && entry->name[0] != ENTRY_ERASED &&
+         entry->attribs != FAT_LFN;
+}
+static bool fat_valid_entry(const struct fat_t *fat, addr_t addr) {
+  struct dir_entry_t entry;
+  return fat_user_entry(fat, addr, &entry);
+}
+/** Entry of a file, as attributes given by user may be wrong */
+static bool fat_valid_file(const struct fat_t *fat, addr_t addr) {
+  struct dir_entry_t entry;
+  return fat_user_entry(fat, addr, &entry) && !(entry.attribs & FAT_DIRECTORY);
+}
+
+static struct fat_pending_t *fat_pending_find(struct fat_t *fat, addr_t entryAddr) {
+  for (int i = 0; i < FAT_PENDING_FILES; i++) {
+    if (fat->pending[i].entryAddr == entryAddr) return &fat->pending[i];
+  }
+  return NULL;
+}
+
+/** Keep the first keep clusters of chain starting at clusterIndex, free others.
+ * Returns last kept cluster, 0 if none */
+static uint16_t fat_trim_chain(struct fat_t *fat, uint16_t clusterIndex, uint32_t keep) {
+  if (clusterIndex == 0) return 0;
+  fat_extents_invalidate(fat, clusterIndex);
+  if (keep == 0) {
+    fat_remove_data(fat, 0, clusterIndex);
+    return 0;
+  }
+  uint16_t last = clusterIndex;
+  for (uint32_t i = 1; i < keep && !fat_is_chain_end(fat, fat->table[last]); i++) last = fat->table[last];
+  const uint16_t next = fat->table[last];
+  if (!fat_is_chain_end(fat, next)) {
+    fat_update_cluster(fat, last, fat_get_cluster_value(fat, 1));
+    fat_remove_data(fat, 0, next);
+  }
+  return last;
+}
+
+/** Release clusters reserved past file size */
+static void fat_pending_trim(struct fat_t *fat, struct fat_pending_t *p) {
+  const uint32_t used = (p->size + fat->bytesPerCluster - 1) / fat->bytesPerCluster;
+  if (p->clusters > used) {
+    p->lastCluster = fat_trim_chain(fat, p->clusterIndex, used);
+    if (used == 0) p->clusterIndex = 0;
+    p->clusters = used;
+  }
+}
+
+/** Release reserved clusters, then save FAT and directory entry once */
+static void fat_pending_flush(struct fat_t *fat, struct fat_pending_t *p) {
+  fat_pending_trim(fat, p);
+  fat_flush(fat);
+
+  struct dir_entry_t entry;
+  disk_read(fat->disk, &entry, p->entryAddr, sizeof(entry));
+  entry.clusterIndex = p->clusterIndex;
+  entry.fileSize = p->size;
+  disk_write(fat->disk, p->entryAddr, &entry, sizeof(entry));
+  p->entryAddr = 0;
+}
+
+/** Pending state of file, created from its directory entry */
+static struct fat_pending_t *fat_pending_get(struct fat_t *fat, addr_t entryAddr) {
+  struct fat_pending_t *p = fat_pending_find(fat, entryAddr);
+  if (p == NULL) {
+    p = &fat->pending[0];
+    for (int i = 0; i < FAT_PENDING_FILES && p->entryAddr != 0; i++) {
+      if (fat->pending[i].entryAddr == 0 || fat->pending[i].lastUse < p->lastUse) p = &fat->pending[i];
+    }
+    if (p->entryAddr != 0) fat_pending_flush(fat, p);
+
+    struct dir_entry_t entry;
+    disk_read(fat->disk, &entry, entryAddr, sizeof(entry));
+    p->entryAddr = entryAddr;
+    p->clusterIndex = entry.clusterIndex;
+    p->size = entry.fileSize;
+    p->clusters = 0;
+    p->lastCluster = 0;
+    const struct fat_extents_t *const e = entry.clusterIndex ? fat_extents(fat, entry.clusterIndex) : NULL;
+    if (e != NULL) {
+      const struct fat_extent_t *const last = &e->runs[e->count - 1];
+      p->clusters = last->logical + last->length;
+      p->lastCluster = last->clusterIndex + last->length - 1;
+    }
+  }
+  p->lastUse = ++fat->pendingUses;
+  return p;
+}
+
+/** fat_alloc_run, taking back clusters reserved by other files when disk is full */
+static uint16_t fat_pending_alloc(struct fat_t *fat, const struct fat_pending_t *grown, uint32_t count, uint32_t *len) {
+  const uint16_t run = fat_alloc_run(fat, count, len);
+  if (run != 0) return run;
+  for (int i = 0; i < FAT_PENDING_FILES; i++) {
+    if (fat->pending[i].entryAddr != 0 && &fat->pending[i] != grown) fat_pending_trim(fat, &fat->pending[i]);
+  }
+  return fat_alloc_run(fat, count, len);
+}
+
+/** Give file at least clusters clusters, reserving a batch past them.
+ * Returns false if disk is full */
+static bool fat_pending_grow(struct fat_t *fat, struct fat_pending_t *p, uint32_t clusters) {
+  // Doubling batches keep few runs while other files grow too
+  uint32_t batch = p->clusters;
+  if (batch < FAT_PREALLOC_CLUSTERS) batch = FAT_PREALLOC_CLUSTERS;
+  if (batch > FAT_PREALLOC_MAX) batch = FAT_PREALLOC_MAX;
+  const uint32_t reserve = clusters > p->clusters + batch ? clusters : p->clusters + batch;
+  if (p->clusterIndex) fat_extents_invalidate(fat, p->clusterIndex);
+  while (p->clusters < clusters) {
+    // Continue right after the file when possible
+    if (p->lastCluster) fat->nextFree = p->lastCluster + 1;
+    uint32_t len;
+    const uint16_t run = fat_pending_alloc(fat, p, reserve - p->clusters, &len);
+    if (run == 0) return false;
+    if (p->lastCluster) {
+      fat_update_cluster(fat, p->lastCluster, run);
+    } else {
+      p->clusterIndex = run;
+    }
+    p->lastCluster = run + len - 1;
+    p->clusters += len;
+  }
+  return true;
+}
+
+/** Size and first cluster of file, including unsaved changes */
+static void fat_pending_apply(struct fat_t *fat, FILE *file) {
+  const struct fat_pending_t *const p = fat_pending_find(fat, file->entryAddr);
+  if (p == NULL || file->entryAddr == 0) return;
+  file->size = p->size;
+  file->clusterIndex = p->clusterIndex;
+}
+
+/** Current size and first cluster of f, which may have changed since the
+ * caller got it */
+static void fat_file_state(struct fat_t *fat, const FILE *f, FILE *file) {
+  *file = *f;
+  struct dir_entry_t entry;
+  disk_read(fat->disk, &entry, f->entryAddr, sizeof(entry));
+  file->size = entry.fileSize;
+  file->clusterIndex = entry.clusterIndex;
+  fat_pending_apply(fat, file);
 }
 
 DIR fat_fs_root(struct filesystem_t* self) {
@@ -400,12 +819,9 @@ DIR fat_fs_root(struct filesystem_t* self) {
   DIR dir = {.clusterIndex = 0};
   return dir;
 }
-void fat_fs_file_name(struct filesystem_t *self, const FILE *f, char *name, size_t len) {
-  if (!(f && name)) return;
-
+/** Trimmed NAME.EXT of entry. len does not include \0 */
+static void fat_short_name(const struct dir_entry_t *entry, char *name, size_t len) {
   size_t cur = 0;
-  const struct dir_entry_t *entry = disk_view(self->disk, f->entryAddr, NULL);
-
   size_t name_len = (sizeof((struct dir_entry_t){0}).name);
   while (name_len && entry->name[name_len-1] == ' ') { name_len--; }
 
@@ -424,13 +840,19 @@ void fat_fs_file_name(struct filesystem_t *self, const FILE *f, char *name, size
     cur += ext_len;
   }
   name[cur] = '\0';
+}
+void fat_fs_file_name(struct filesystem_t *self, const FILE *f, char *name, size_t len) {
+  if (!(f && name)) return;
+
+  const struct dir_entry_t *entry = disk_view(FAT(self)->disk, f->entryAddr, NULL);
+  fat_short_name(entry, name, len);
 
   // Long file name
-  cur = 0;
+  size_t cur = 0;
   addr_t lfnAddr = f->entryAddr;
   while (cur < len) {
     lfnAddr -= sizeof(struct dir_entry_t);
-    entry = disk_view(self->disk, lfnAddr, NULL);
+    entry = disk_view(FAT(self)->disk, lfnAddr, NULL);
 
     if (entry->attribs != FAT_LFN) break;
     for (uint8_t i = 0; i < sizeof(lfn_chars)/sizeof(lfn_chars[0]) && cur < len; i++) {
@@ -442,47 +864,311 @@ void fat_fs_file_name(struct filesystem_t *self, const FILE *f, char *name, size
 
   return;
 }
+
+/** Long file name pieces seen before their short entry */
+struct fat_lfn_t {
+  bool valid;
+  uint8_t checksum;
+  char name[FILE_SHORTNAME_SIZE + 1];
+};
+
+/** Checksum of short name kept in its long name entries */
+static uint8_t fat_lfn_checksum(const struct dir_entry_t *entry) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < sizeof(entry->name) + sizeof(entry->ext); i++) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + entry->name[i];
+  }
+  return sum;
+}
+
+/** Pieces are stored last first, each one holding 13 chars */
+static void fat_lfn_piece(struct fat_lfn_t *lfn, const struct dir_entry_t *entry) {
+  const uint8_t *const raw = (const uint8_t *)entry;
+  if (raw[0] & 0x40) {
+    memset(lfn->name, 0, sizeof(lfn->name));
+    lfn->valid = true;
+    lfn->checksum = raw[13];
+  }
+  const uint32_t ord = raw[0] & 0x1f;
+  if (!lfn->valid || ord == 0 || raw[13] != lfn->checksum) {
+    lfn->valid = false;
+    return;
+  }
+  const size_t nchars = sizeof(lfn_chars)/sizeof(lfn_chars[0]);
+  for (size_t i = 0; i < nchars && (ord - 1) * nchars + i < FILE_SHORTNAME_SIZE; i++) {
+    lfn->name[(ord - 1) * nchars + i] = raw[lfn_chars[i]];
+  }
+}
+
+/** Fill file from entry at addr in dir */
+static void fat_entry_file(const struct dir_entry_t *entry, const DIR dir, addr_t addr, FILE *file) {
+  file->size = entry->fileSize;
+  file->attribs = 0;
+  if (entry->attribs & FAT_READ_ONLY) file->attribs |= FILE_READ_ONLY;
+  if (entry->attribs & FAT_HIDDEN) file->attribs |= FILE_HIDDEN;
+  if (entry->attribs & FAT_DIRECTORY) file->attribs |= FILE_DIRECTORY;
+
+  file->createdAt = entry->createdAt;
+  file->accessAt = entry->accessAt;
+  file->modifiedAt = entry->modifiedAt;
+  file->parentCluster = dir.clusterIndex;
+  file->clusterIndex = entry->clusterIndex;
+  file->entryAddr = addr;
+}
+
+void fat_fs_opendir(struct filesystem_t *self, const DIR dir, DIR_CURSOR *cursor) {
+  (void)self;
+  fat_cursor_start(cursor, dir);
+}
+int fat_fs_readdir(struct filesystem_t *self, DIR_CURSOR *cursor, FILE *files, size_t nfiles) {
+  struct fat_t *const fat = FAT(self);
+  // Calls end after a short entry, so long names never span two calls
+  struct fat_lfn_t lfn = {.valid = false};
+  size_t i = 0;
+  while (i < nfiles) {
+    const addr_t addr = fat_cursor_next(fat, cursor);
+    if (!addr) break;
+
+    struct dir_entry_t entry;
+    disk_read(fat->disk, &entry, addr, sizeof(entry));
+    if (entry.name[0] == ENTRY_AVAILABLE || entry.name[0] == ENTRY_ERASED) {
+      lfn.valid = false;
+      continue;
+    }
+    if (entry.attribs == FAT_LFN) {
+      fat_lfn_piece(&lfn, &entry);
+      continue;
+    }
+    if (!(entry.attribs & (FAT_SYSTEM | FAT_VOLUME_ID))) {
+      fat_entry_file(&entry, cursor->dir, addr, &files[i]);
+      fat_pending_apply(fat, &files[i]);
+      if (lfn.valid && lfn.checksum == fat_lfn_checksum(&entry)) {
+        memcpy(files[i].name, lfn.name, sizeof(files[i].name));
+      } else {
+        fat_short_name(&entry, files[i].name, FILE_SHORTNAME_SIZE);
+      }
+      i++;
+    }
+    lfn.valid = false;
+  }
+  return i;
+}
 int fat_fs_list(struct filesystem_t *self, const DIR dir, FILE *files, size_t nfiles, size_t offset) {
-  int32_t current = offset;
-  for (size_t i = 0; i < nfiles; i++) {
-    bool visible = false;
-    do {
-      addr_t addr = fat_find_entry(self->disk, dir.clusterIndex, false, current, &current);
-      if (!addr) return i;
-
-      current++;
-      const struct dir_entry_t* entry = disk_view(self->disk, addr, NULL);
-      if (entry->attribs & (FAT_SYSTEM | FAT_VOLUME_ID)) continue;
-      visible = true;
-
-      files[i].size = entry->fileSize;
-      files[i].attribs = 0;
-      if (entry->attribs & FAT_READ_ONLY) files[i].attribs |= FILE_READ_ONLY;
-      if (entry->attribs & FAT_HIDDEN) files[i].attribs |= FILE_HIDDEN;
-      if (entry->attribs & FAT_DIRECTORY) files[i].attribs |= FILE_DIRECTORY;
-
-      files[i].createdAt = entry->createdAt;
-      files[i].accessAt = entry->accessAt;
-      files[i].modifiedAt = entry->modifiedAt;
-      files[i].parentCluster = dir.clusterIndex;
-      files[i].clusterIndex = entry->clusterIndex;
-      files[i].entryAddr = addr;
-
-      fat_fs_file_name(self, &files[i], &files[i].name[0], FILE_SHORTNAME_SIZE);
-    } while (!visible);
-  }
-  return nfiles;
+  DIR_CURSOR cursor;
+  fat_cursor_start(&cursor, dir);
+  for (size_t i = 0; i < offset; i++) {
+    FILE skipped;
+    if (fat_fs_readdir(self, &cursor, &skipped, 1) == 0) return 0;
+  }
+  return fat_fs_readdir(self, &cursor, files, nfiles);
+}
+/** Short names are stored upper case */
+static bool fat_name_equal(const char *a, const char *b) {
+  while (*a != '\0' && toupper(*a) == toupper(*b)) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+int fat_fs_lookup(struct filesystem_t *self, const DIR dir, const char *name, FILE *file) {
+  // Single pass over the directory
+  DIR_CURSOR cursor;
+  fat_cursor_start(&cursor, dir);
+  while (fat_fs_readdir(self, &cursor, file, 1) == 1) {
+    if (fat_name_equal(file->name, name)) return 0;
+  }
+  return -1;
 }
 int fat_fs_read(struct filesystem_t *self, void *dst, const FILE *f, size_t offset, size_t len) {
-  if (len > f->size - offset) len = f->size - offset;
-  return fat_read_data(self->disk, f->clusterIndex, dst, len, offset);
+  if (!fat_valid_entry(FAT(self), f->entryAddr)) return -1;
+  FILE file;
+  fat_file_state(FAT(self), f, &file);
+  if (offset >= file.size || file.clusterIndex == 0) return 0;
+  if (len > file.size - offset) len = file.size - offset;
+  return fat_read_data(FAT(self), file.clusterIndex, dst, len, offset);
+}
+void fat_fs_stat(struct filesystem_t *self, const FILE *f, FILE *file) {
+  if (fat_valid_entry(FAT(self), f->entryAddr)) {
+    fat_file_state(FAT(self), f, file);
+  } else {
+    *file = *f;
+  }
+}
+size_t fat_fs_bmap(struct filesystem_t *self, const FILE *f, size_t offset, addr_t *addr) {
+  struct fat_t *const fat = FAT(self);
+  if (!fat_valid_entry(fat, f->entryAddr)) return 0;
+  FILE file;
+  fat_file_state(fat, f, &file);
+  if (offset >= file.size || file.clusterIndex == 0) return 0;
+  const struct fat_extents_t *const e = fat_extents(fat, file.clusterIndex);
+  if (e == NULL) return 0;
+  const uint32_t run = fat_extent_find(e, offset / fat->bytesPerCluster);
+  if (run >= e->count) return 0;
+
+  const size_t start = offset - e->runs[run].logical * fat->bytesPerCluster;
+  *addr = fat_get_cluster_addr(fat, e->runs[run].clusterIndex) + start;
+  const size_t len = e->runs[run].length * fat->bytesPerCluster - start;
+  return len < file.size - offset ? len : file.size - offset;
 }
 int fat_fs_write(struct filesystem_t *self, const FILE *f, size_t offset, const void *src, size_t len) {
-  if (len > f->size - offset) len = f->size - offset;
-  return fat_write_data(self->disk, f->clusterIndex, src, len, offset);
+  struct fat_t *const fat = FAT(self);
+  if (!fat_valid_file(fat, f->entryAddr)) return -1;
+  struct fat_pending_t *const p = fat_pending_get(fat, f->entryAddr);
+  // Broken chain or out of memory
+  if (offset > p->size || (p->clusterIndex && !p->clusters)) return -1;
+  if (len == 0) return 0;
+
+  // Appends grow the file, the directory entry is saved on flush
+  const uint32_t clusters = (offset + len + fat->bytesPerCluster - 1) / fat->bytesPerCluster;
+  if (clusters > p->clusters && !fat_pending_grow(fat, p, clusters)) {
+    // Disk full: write what fits
+    if (p->clusters * fat->bytesPerCluster <= offset) return -1;
+    len = p->clusters * fat->bytesPerCluster - offset;
+  }
+  const int written = fat_write_data(fat, p->clusterIndex, src, len, offset);
+  if (written > 0 && offset + written > p->size) p->size = offset + written;
+  return written;
 }
+int fat_fs_create(struct filesystem_t *self, const DIR dir, const char *name, FILE *file) {
+  struct fat_t *const fat = FAT(self);
+  if (!fat_is_short_name(name)) return -1;
+  struct dir_entry_t entry;
+  memset(&entry, 0, sizeof(entry));
+  fat_split_path(entry.name, entry.ext, name);
+  entry.attribs = FAT_ARCHIVE;
+
+  // Check name and find a free entry in one pass
+  DIR_CURSOR cursor;
+  fat_cursor_start(&cursor, dir);
+  addr_t addr, freeAddr = 0;
+  uint16_t lastCluster = 0;
+  while ((addr = fat_cursor_next(fat, &cursor))) {
+    struct dir_entry_t other;
+    disk_read(fat->disk, &other, addr, sizeof(other));
+    if (other.name[0] == ENTRY_AVAILABLE || other.name[0] == ENTRY_ERASED) {
+      if (!freeAddr) freeAddr = addr;
+    } else if (other.attribs != FAT_LFN &&
+               memcmp(other.name, entry.name, sizeof(entry.name) + sizeof(entry.ext)) == 0) {
+      return -3;
+    }
+    if (cursor.cluster) lastCluster = cursor.cluster;
+  }
 
-void load_fat16(struct filesystem_t *fs) {
+  if (!freeAddr) {
+    // Subdirectories grow by one empty cluster
+    uint32_t len;
+    const uint16_t cluster = lastCluster ? fat_pending_alloc(fat, NULL, 1, &len) : 0;
+    if (!cluster) return -1;
+    fat_update_cluster(fat, lastCluster, cluster);
+    fat_extents_invalidate(fat, dir.clusterIndex);
+    fat_flush(fat);
+    freeAddr = fat_get_cluster_addr(fat, cluster);
+    const struct dir_entry_t available = {.name = {ENTRY_AVAILABLE}};
+    for (uint32_t i = 0; i < fat->bytesPerCluster / sizeof(available); i++) {
+      disk_write(fat->disk, freeAddr + i * sizeof(available), &available, sizeof(available));
+    }
+  }
+
+  disk_write(fat->disk, freeAddr, &entry, sizeof(entry));
+  fat_entry_file(&entry, dir, freeAddr, file);
+  fat_short_name(&entry, file->name, FILE_SHORTNAME_SIZE);
+  return 0;
+}
+int fat_fs_truncate(struct filesystem_t *self, const FILE *f, size_t size) {
+  struct fat_t *const fat = FAT(self);
+  if (!fat_valid_file(fat, f->entryAddr)) return -1;
+  struct fat_pending_t *const p = fat_pending_get(fat, f->entryAddr);
+  if (size > p->size) return -1;
+  p->size = size;
+  fat_pending_flush(fat, p);
+  return 0;
+}
+int fat_fs_unlink(struct filesystem_t *self, const FILE *f) {
+  struct fat_t *const fat = FAT(self);
+  if (!fat_valid_file(fat, f->entryAddr)) return -1;
+  // Reserved clusters go with the others
+  struct fat_pending_t *const p = fat_pending_get(fat, f->entryAddr);
+  if (p->clusterIndex) fat_trim_chain(fat, p->clusterIndex, 0);
+  p->entryAddr = 0;
+  fat_remove_dir_entry(fat, f->entryAddr);
+  return 0;
+}
+void fat_fs_sync(struct filesystem_t *self) {
+  struct fat_t *const fat = FAT(self);
+  for (int i = 0; i < FAT_PENDING_FILES; i++) {
+    if (fat->pending[i].entryAddr != 0) fat_pending_flush(fat, &fat->pending[i]);
+  }
+  fat_flush(fat);
+}
+
+int fat_fs_fragments(struct filesystem_t *self, const FILE *f, uint32_t *clusters) {
+  struct fat_t *const fat = FAT(self);
+  *clusters = 0;
+  if (!fat_valid_entry(fat, f->entryAddr)) return -1;
+  FILE file;
+  fat_file_state(fat, f, &file);
+  if (file.clusterIndex == 0) return 0;
+  const struct fat_extents_t *const e = fat_extents(fat, file.clusterIndex);
+  if (e == NULL) return -1;
+  *clusters = e->runs[e->count - 1].logical + e->runs[e->count - 1].length;
+  return e->count;
+}
+int fat_fs_relocate(struct filesystem_t *self, const FILE *f) {
+  struct fat_t *const fat = FAT(self);
+  if (!fat_valid_entry(fat, f->entryAddr) || (f->attribs & FILE_DIRECTORY)) return -1;
+  // Entry is current once reserved clusters are released
+  struct fat_pending_t *const p = fat_pending_find(fat, f->entryAddr);
+  if (p != NULL) fat_pending_flush(fat, p);
+  struct dir_entry_t entry;
+  disk_read(fat->disk, &entry, f->entryAddr, sizeof(entry));
+  const uint16_t first = entry.clusterIndex;
+  const struct fat_extents_t *const e = first ? fat_extents(fat, first) : NULL;
+  if (e == NULL || e->count == 1) return first && e == NULL ? -1 : 0;
+  const uint32_t clusters = e->runs[e->count - 1].logical + e->runs[e->count - 1].length;
+
+  // First fit from the start of the volume keeps files packed on the
+  // first cylinders
+  fat->nextFree = 2;
+  uint32_t len;
+  const uint16_t run = fat_alloc_run(fat, clusters, &len);
+  if (run == 0) return -1;
+  char *const buf = len == clusters ? mem_alloc(fat->bytesPerCluster) : NULL;
+  if (buf == NULL) {
+    fat_remove_data(fat, 0, run);
+    return -1;
+  }
+  fat_extents_invalidate(fat, run);
+
+  // Old chain stays valid until the entry points to the copy: data first,
+  // then every FAT copy, then the entry, then the old chain is freed. The
+  // cache writes back lowest blocks first, so each step is flushed before
+  // the next one
+  for (uint32_t i = 0; i < e->count; i++) {
+    for (uint32_t c = 0; c < e->runs[i].length; c++) {
+      disk_read(fat->disk, buf, fat_get_cluster_addr(fat, e->runs[i].clusterIndex + c), fat->bytesPerCluster);
+      disk_write(fat->disk, fat_get_cluster_addr(fat, run + e->runs[i].logical + c), buf, fat->bytesPerCluster);
+    }
+  }
+  mem_free(buf, fat->bytesPerCluster);
+  disk_flush(fat->disk);
+  fat_flush(fat);
+  disk_flush(fat->disk);
+  entry.clusterIndex = run;
+  disk_write(fat->disk, f->entryAddr, &entry, sizeof(entry));
+  disk_flush(fat->disk);
+  fat_remove_data(fat, 0, first);
+  return clusters;
+}
+uint32_t fat_fs_space(struct filesystem_t *self, uint32_t *runs) {
+  const struct fat_t *const fat = FAT(self);
+  *runs = 0;
+  for (uint32_t clusterIndex = 2; clusterIndex < fat_cluster_end(fat); clusterIndex++) {
+    if (fat_is_free(fat, clusterIndex) && (clusterIndex == 2 || !fat_is_free(fat, clusterIndex - 1))) (*runs)++;
+  }
+  return fat->freeCount;
+}
+
+static void fat_fs_ops(struct filesystem_t *fs) {
   assert(sizeof(struct bios_block_t) == 62);
   assert(sizeof(struct dir_entry_t) == 32);
   assert(sizeof(struct fat_date_t) == 2);
@@ -490,9 +1176,35 @@ void load_fat16(struct filesystem_t *fs) {
 
   fs->root = fat_fs_root;
   fs->list = fat_fs_list;
+  fs->lookup = fat_fs_lookup;
+  fs->opendir = fat_fs_opendir;
+  fs->readdir = fat_fs_readdir;
   fs->file_name = fat_fs_file_name;
   fs->read = fat_fs_read;
+  fs->stat = fat_fs_stat;
+  fs->bmap = fat_fs_bmap;
   fs->write = fat_fs_write;
+  fs->create = fat_fs_create;
+  fs->truncate = fat_fs_truncate;
+  fs->unlink = fat_fs_unlink;
+  fs->sync = fat_fs_sync;
+  fs->fragments = fat_fs_fragments;
+  fs->relocate = fat_fs_relocate;
+  fs->space = fat_fs_space;
+}
+
+void load_fat16(struct filesystem_t *fs) {
+  fat_fs_ops(fs);
+
+  struct bios_block_t bpb;
+  disk_read(fs->disk, &bpb, 0, sizeof(bpb));
+  struct fat_t *const fat = mem_alloc(sizeof(struct fat_t));
+  assert(fat);
+  fat_mount(fat, fs->disk, &bpb);
+  // First copy is the reference
+  disk_read(fat->disk, fat->table, fat->fatAddr, fat->fatSize);
+  fat_build_free_map(fat);
+  fs->arg = fat;
 }
 
 void new_fat16(struct filesystem_t *fs, size_t sectorCount) {
@@ -519,10 +1231,6 @@ void new_fat16(struct filesystem_t *fs, size_t sectorCount) {
     .fileSystem = {'F', 'A', 'T', '1', '6', ' ', ' ', ' '},
   };
 
-  // Allocate device
-  const unsigned long imageSize = bpb.sectorCount * bpb.bytesPerSector;
-  new_mem_disk(fs->disk, imageSize, ENTRY_ERASED);
-
   // Create dummy boot sector
   uint8_t bootSector[0x200];
   memset(bootSector, 0, sizeof(bootSector));
@@ -531,6 +1239,9 @@ void new_fat16(struct filesystem_t *fs, size_t sectorCount) {
   bootSector[0x1ff] = 0xaa;
 
   // Initialize image
-  load_fat16(fs);
-  fat_format(fs->disk, (struct bios_block_t *)&bootSector);
+  fat_fs_ops(fs);
+  struct fat_t *const fat = mem_alloc(sizeof(struct fat_t));
+  assert(fat);
+  fat_format(fat, fs->disk, (struct bios_block_t *)&bootSector);
+  fs->arg = fat;
 }
@@ -6,7 +6,7 @@
 /** Load FAT16 fs from disk. */
 void load_fat16(struct filesystem_t*);
 
-/** Create new in memory FAT16 fs on disk */
+/** Format disk of sectorCount sectors as a new FAT16 fs and load it */
 void new_fat16(struct filesystem_t*, size_t sectorCount);
 
 #endif /*FAT16_H_*/
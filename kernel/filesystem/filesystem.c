@@ -1,32 +1,588 @@
 #include "floppy.h"
+#include "bcache.h"
+#include "console.h"
+#include "dcache.h"
 #include "fat16.h"
+#include "interrupt.h"
+#include "queues.h"
+#include "scheduler.h"
 #include "stdio.h"
+#include "string.h"
 
+/** In memory disk size, in sectors */
+#define MEM_DISK_SECTORS 128
+/** File metadata and dirty blocks are written back after at most this delay */
+#define FS_WRITEBACK_MS 2000
+/** Files read sequentially at the same time */
+#define FS_READAHEAD_STREAMS 4
+/** Read-ahead window in bytes, doubling while reads stay sequential */
+#define FS_READAHEAD_MIN (4 * BCACHE_BLOCK_SIZE)
+#define FS_READAHEAD_MAX (BCACHE_RUN_BLOCKS * BCACHE_BLOCK_SIZE)
+/** Disk ranges prefetched per request */
+#define FS_READAHEAD_RUNS 4
+/** Files open by all processes */
+#define FS_OPEN_FILES 32
+/** Deeper directories are not walked by fs_frag_report and fs_defrag */
+#define FS_WALK_DEPTH 8
+
+struct block_dev_t raw_dev;
+struct bcache_t root_cache;
 struct disk_t root_disk = {0};
 struct filesystem_t root_fs = {0};
+/** Process using root_fs, which may sleep on disk, or NULL */
+static struct process_t *root_owner = NULL;
+
+static void lock() {
+  while (root_owner != NULL) wait_clock(current_clock() + 1);
+  root_owner = getproc();
+  uninterruptible_enter();
+}
+static void unlock() {
+  root_owner = NULL;
+  uninterruptible_leave();
+}
+
+bool fs_lock_held() { return root_owner == getproc(); }
+void fs_release_lock(const struct process_t *ps) {
+  if (root_owner == ps) root_owner = NULL;
+  bcache_release(&root_cache, ps);
+  block_release(&raw_dev, ps);
+}
+
+/** Sequential reader of a file */
+struct readahead_t {
+  FILE file;
+  /** Offset expected from a sequential read */
+  size_t next;
+  /** 0 until reads are sequential */
+  size_t window;
+  /** Requested prefetch range, up to end */
+  size_t start, end;
+  unsigned long lastUse;
+};
+static struct readahead_t streams[FS_READAHEAD_STREAMS];
+static unsigned long stream_uses = 0;
+/** Streams to prefetch */
+static int readahead_queue = -1;
+
+/** File opened by fs_open */
+struct open_file_t {
+  /** Descriptors referring to it, 0 if free */
+  int users;
+  FILE file;
+  /** See file_open_flags */
+  int flags;
+  /** Offset of next read or write */
+  size_t pos;
+  /** Data at offset extentAt is extentLen bytes contiguous on disk at
+   * extentAddr, while extentLayout is layout */
+  size_t extentAt, extentLen;
+  addr_t extentAddr;
+  unsigned long extentLayout;
+  struct readahead_t ahead;
+};
+static struct open_file_t open_files[FS_OPEN_FILES];
+/** Changed when file data may move or be freed */
+static unsigned long layout = 0;
+
+/** Streams in readahead_queue messages: streams, then those of open_files */
+static int stream_index(const struct readahead_t *s) {
+  if (s >= streams && s < &streams[FS_READAHEAD_STREAMS]) return s - streams;
+  const struct open_file_t *const o =
+      (const struct open_file_t *)((const char *)s - offsetof(struct open_file_t, ahead));
+  return FS_READAHEAD_STREAMS + (o - open_files);
+}
+/** Stream of index i, NULL if out of range */
+static struct readahead_t *stream_at(int i) {
+  if (i >= 0 && i < FS_READAHEAD_STREAMS) return &streams[i];
+  if (i >= FS_READAHEAD_STREAMS && i < FS_READAHEAD_STREAMS + FS_OPEN_FILES) {
+    return &open_files[i - FS_READAHEAD_STREAMS].ahead;
+  }
+  return NULL;
+}
+
+/** Stream reading f through fs_read, replacing the least recently used */
+static struct readahead_t *stream_of(const FILE *f) {
+  struct readahead_t *s = &streams[0];
+  for (int i = 0; i < FS_READAHEAD_STREAMS; i++) {
+    if (streams[i].file.entryAddr == f->entryAddr) return &streams[i];
+    if (streams[i].lastUse < s->lastUse) s = &streams[i];
+  }
+  memset(s, 0, sizeof(*s));
+  s->file = *f;
+  return s;
+}
+
+/** Update reader s after a read, and ask for data following it */
+static void readahead(struct readahead_t *s, size_t offset, size_t len) {
+  s->lastUse = ++stream_uses;
+
+  // Reading from the start counts as sequential
+  if (offset == s->next || offset == 0) {
+    s->window = s->window == 0 ? FS_READAHEAD_MIN : s->window * 2;
+    if (s->window > FS_READAHEAD_MAX) s->window = FS_READAHEAD_MAX;
+  } else {
+    s->window = 0;
+  }
+  s->next = offset + len;
+  if (s->window == 0 || s->end >= s->next + s->window) return;
+
+  if (s->start < s->next) s->start = s->next;
+  s->end = s->next + s->window;
+  // Read-ahead is a hint: skip it rather than block the reader
+  int count;
+  if (readahead_queue >= 0 && pcount(readahead_queue, &count) == 0 && count < FS_READAHEAD_STREAMS) {
+    psend(readahead_queue, stream_index(s));
+  }
+}
+
+/** Kernel process loading requested stream ranges in the block cache,
+ * while readers consume previous data */
+static int fs_readahead(void *arg) {
+  (void)arg;
+  int msg;
+  while (preceive(readahead_queue, &msg) == 0) {
+    addr_t addrs[FS_READAHEAD_RUNS];
+    size_t lens[FS_READAHEAD_RUNS];
+    int n = 0;
+    struct readahead_t *const s = stream_at(msg);
+    if (s == NULL) continue;
+    lock();
+    while (n < FS_READAHEAD_RUNS && s->start < s->end) {
+      lens[n] = root_fs.bmap(&root_fs, &s->file, s->start, &addrs[n]);
+      if (lens[n] == 0) break;
+      if (lens[n] > s->end - s->start) lens[n] = s->end - s->start;
+      s->start += lens[n++];
+    }
+    unlock();
+    // Readers only wait for the cache while it loads
+    for (int r = 0; r < n; r++) bcache_prefetch(&root_cache, addrs[r], lens[r]);
+  }
+  return 0;
+}
+
+/** Kernel process syncing root_fs periodically */
+static int fs_writeback(void *arg) {
+  (void)arg;
+  unsigned long quartz;
+  unsigned long ticks;
+  clock_settings(&quartz, &ticks);
+  for (;;) {
+    wait_clock(current_clock() + (quartz / ticks) * FS_WRITEBACK_MS / 1000);
+    fs_sync();
+  }
+  return 0;
+}
+
 void setup_filesystem() {
   // NOTE: Assume filesystem is FAT16
 
-  // Load floppy or use in memory disk
+  // Load floppy or use in memory disk, seen by filesystem through the cache
+  const bool floppy = load_floppy(&raw_dev);
+  if (!floppy) {
+    printf("Using in memory disk !\n");
+    new_mem_block(&raw_dev, MEM_DISK_SECTORS * BLOCK_SECTOR_SIZE, 0);
+  }
+  new_bcache_disk(&root_disk, &root_cache, &raw_dev, BCACHE_BLOCKS);
   root_fs.disk = &root_disk;
-  if (load_floppy(&root_disk)) {
+  if (floppy) {
     load_fat16(&root_fs);
   } else {
-    printf("Using in memory disk !\n");
-    new_fat16(&root_fs, 128);
+    new_fat16(&root_fs, MEM_DISK_SECTORS);
   }
+  start_background(fs_writeback, 512, 1, "fs_writeback", NULL);
+  // Above the shell at prio 1, so prefetch runs as soon as it waits
+  readahead_queue = pcreate_kernel(FS_READAHEAD_STREAMS);
+  if (readahead_queue >= 0) start_background(fs_readahead, 512, 2, "fs_readahead", NULL);
 }
 
 DIR fs_root() { return root_fs.root(&root_fs); }
 int fs_list(const DIR dir, FILE *files, size_t nfiles, size_t offset) {
-  return root_fs.list(&root_fs, dir, files, nfiles, offset);
+  lock();
+  const int ret = root_fs.list(&root_fs, dir, files, nfiles, offset);
+  unlock();
+  return ret;
+}
+void fs_opendir(const DIR dir, DIR_CURSOR *cursor) {
+  root_fs.opendir(&root_fs, dir, cursor);
+}
+int fs_readdir(DIR_CURSOR *cursor, FILE *files, size_t nfiles) {
+  lock();
+  const int ret = root_fs.readdir(&root_fs, cursor, files, nfiles);
+  unlock();
+  return ret;
+}
+/** Find file at path, up to end */
+static int lookup(const DIR dir, const char *path, const char *end, FILE *file) {
+  DIR cur = *path == '/' ? fs_root() : dir;
+  char name[FILE_SHORTNAME_SIZE + 1];
+  bool found = false;
+  for (;;) {
+    while (path < end && *path == '/') path++;
+    if (path == end) return found ? 0 : -1;
+    const char *const slash = memchr(path, '/', end - path);
+    const size_t len = (slash ? slash : end) - path;
+    if (len > FILE_SHORTNAME_SIZE) return -1;
+    memcpy(name, path, len);
+    name[len] = '\0';
+    path += len;
+
+    if (found) {
+      if (!(file->attribs & FILE_DIRECTORY)) return -2;
+      cur.clusterIndex = file->clusterIndex;
+    }
+    int ret = dcache_get(cur.clusterIndex, name, file);
+    if (ret < 0) {
+      ret = root_fs.lookup(&root_fs, cur, name, file) == 0;
+      dcache_put(cur.clusterIndex, name, ret ? file : NULL);
+    }
+    if (!ret) return -1;
+    found = true;
+  }
+}
+int fs_lookup(const DIR dir, const char *path, FILE *file) {
+  lock();
+  const int ret = lookup(dir, path, path + strlen(path), file);
+  unlock();
+  return ret;
 }
 void fs_file_name(const FILE *f, char *name, size_t len) {
-  return root_fs.file_name(&root_fs, f, name, len);
+  lock();
+  root_fs.file_name(&root_fs, f, name, len);
+  unlock();
 }
 int fs_read(void *dst, const FILE *f, size_t offset, size_t len) {
-  return root_fs.read(&root_fs, dst, f, offset, len);
+  lock();
+  const int ret = root_fs.read(&root_fs, dst, f, offset, len);
+  unlock();
+  // Outside lock: read-ahead process may run at once
+  if (ret > 0) readahead(stream_of(f), offset, ret);
+  return ret;
 }
 int fs_write(const FILE *f, size_t offset, const void *src, size_t len) {
-  return root_fs.write(&root_fs, f, offset, src, len);
+  lock();
+  // Cached entry would be stale once file metadata changes
+  dcache_invalidate(f->parentCluster);
+  const int ret = root_fs.write(&root_fs, f, offset, src, len);
+  unlock();
+  return ret;
+}
+int fs_create(const DIR dir, const char *name, FILE *file) {
+  lock();
+  dcache_invalidate(dir.clusterIndex);
+  const int ret = root_fs.create(&root_fs, dir, name, file);
+  unlock();
+  return ret;
+}
+int fs_truncate(const FILE *f, size_t size) {
+  lock();
+  dcache_invalidate(f->parentCluster);
+  layout++;
+  const int ret = root_fs.truncate(&root_fs, f, size);
+  unlock();
+  return ret;
+}
+int fs_unlink(const FILE *f) {
+  lock();
+  // Its clusters would be reused under open descriptors
+  for (int i = 0; i < FS_OPEN_FILES; i++) {
+    if (open_files[i].users > 0 && open_files[i].file.entryAddr == f->entryAddr) {
+      unlock();
+      return -1;
+    }
+  }
+  dcache_invalidate(f->parentCluster);
+  layout++;
+  const int ret = root_fs.unlink(&root_fs, f);
+  unlock();
+  return ret;
+}
+void fs_sync() {
+  lock();
+  root_fs.sync(&root_fs);
+  unlock();
+  bcache_sync(&root_cache);
+}
+void fs_cache_status(struct disk_cache_status_t *status) { bcache_status(&root_cache, status); }
+
+/** Create file at path, in an existing directory */
+static int create(const DIR dir, const char *path, FILE *file) {
+  const char *name = strrchr(path, '/');
+  DIR parent = dir;
+  if (name == NULL) {
+    name = path;
+  } else {
+    const char *end = name++;
+    while (end > path && end[-1] == '/') end--;
+    if (end == path) {
+      parent = fs_root();
+    } else {
+      FILE d;
+      const int ret = lookup(dir, path, end, &d);
+      if (ret < 0) return ret;
+      if (!(d.attribs & FILE_DIRECTORY)) return -2;
+      parent.clusterIndex = d.clusterIndex;
+    }
+  }
+  dcache_invalidate(parent.clusterIndex);
+  return root_fs.create(&root_fs, parent, name, file);
+}
+/** Open file of current process descriptor fd, or NULL */
+static struct open_file_t *fd_file(int fd) {
+  return fd >= 0 && fd < NBFILES ? getproc()->files[fd] : NULL;
+}
+int fs_open(const DIR dir, const char *path, int flags) {
+  struct process_t *const ps = getproc();
+  int fd = 0;
+  while (fd < NBFILES && ps->files[fd] != NULL) fd++;
+  struct open_file_t *o = &open_files[0];
+  while (o < &open_files[FS_OPEN_FILES] && o->users > 0) o++;
+  if (fd == NBFILES || o == &open_files[FS_OPEN_FILES]) return -1;
+  // Taken before sleeping on the lock
+  memset(o, 0, sizeof(*o));
+  o->users = 1;
+  o->flags = flags;
+
+  lock();
+  int ret = lookup(dir, path, path + strlen(path), &o->file);
+  if (ret == -1 && (flags & OPEN_CREATE)) ret = create(dir, path, &o->file);
+  if (ret == 0 && (o->file.attribs & FILE_DIRECTORY)) ret = -2;
+  if (ret == 0 && (flags & OPEN_TRUNCATE)) {
+    dcache_invalidate(o->file.parentCluster);
+    layout++;
+    ret = root_fs.truncate(&root_fs, &o->file, 0);
+  }
+  unlock();
+  if (ret < 0) {
+    o->users = 0;
+    return ret;
+  }
+  o->ahead.file = o->file;
+  ps->files[fd] = o;
+  return fd;
+}
+int fs_close(int fd) {
+  struct open_file_t *const o = fd_file(fd);
+  if (o == NULL) return -1;
+  getproc()->files[fd] = NULL;
+  o->users--;
+  return 0;
+}
+/** Bytes of o contiguous on disk from offset, at o->extentAddr +
+ * offset - o->extentAt. Return 0 past end of file */
+static size_t extent_at(struct open_file_t *o, size_t offset) {
+  // Cluster chain is only looked up when leaving the cached extent
+  if (o->extentLayout != layout || offset < o->extentAt || offset >= o->extentAt + o->extentLen) {
+    o->extentAt = offset;
+    o->extentLen = root_fs.bmap(&root_fs, &o->file, offset, &o->extentAddr);
+    o->extentLayout = layout;
+  }
+  return o->extentAt + o->extentLen - offset;
+}
+/** Read from o at offset, holding the lock. Return readded size */
+static size_t file_read(struct open_file_t *o, char *dst, size_t offset, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    size_t n = extent_at(o, offset);
+    if (n == 0) break;
+    if (n > len - done) n = len - done;
+    disk_read(root_fs.disk, dst + done, o->extentAddr + (offset - o->extentAt), n);
+    offset += n;
+    done += n;
+  }
+  return done;
+}
+/** Write len bytes of o from offset to the console, straight from the
+ * block cache, holding the lock. Return written size */
+static size_t file_send(struct open_file_t *o, size_t offset, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    size_t n = extent_at(o, offset);
+    if (n == 0) break;
+    if (n > len - done) n = len - done;
+    size_t size;
+    const char *const block = disk_view(root_fs.disk, o->extentAddr + (offset - o->extentAt), &size);
+    if (n > size) n = size;
+    // Block stays cached: the console does not sleep
+    console_putbytes(block, n);
+    offset += n;
+    done += n;
+  }
+  return done;
+}
+/** Write to o at offset, or at its end if appending, holding the lock.
+ * Move offset past written data. Return error or written size */
+static int file_write(struct open_file_t *o, size_t *offset, const void *src, size_t len) {
+  if (o->flags & OPEN_APPEND) {
+    FILE file;
+    root_fs.stat(&root_fs, &o->file, &file);
+    *offset = file.size;
+  }
+  dcache_invalidate(o->file.parentCluster);
+  const int ret = root_fs.write(&root_fs, &o->file, *offset, src, len);
+  if (ret > 0) *offset += ret;
+  return ret;
+}
+int fs_fread(int fd, void *dst, size_t len) {
+  struct open_file_t *const o = fd_file(fd);
+  if (o == NULL) return -1;
+  lock();
+  const size_t start = o->pos;
+  const size_t done = file_read(o, dst, start, len);
+  o->pos += done;
+  unlock();
+  if (done > 0) readahead(&o->ahead, start, done);
+  return done;
+}
+int fs_sendfile(int fd, size_t len) {
+  struct open_file_t *const o = fd_file(fd);
+  if (o == NULL) return -1;
+  size_t done = 0;
+  while (done < len) {
+    // In windows, so following data is prefetched while the console scrolls
+    const size_t window = len - done < FS_READAHEAD_MAX ? len - done : FS_READAHEAD_MAX;
+    lock();
+    const size_t start = o->pos;
+    const size_t n = file_send(o, start, window);
+    o->pos += n;
+    unlock();
+    if (n == 0) break;
+    readahead(&o->ahead, start, n);
+    done += n;
+  }
+  return done;
+}
+int fs_fwrite(int fd, const void *src, size_t len) {
+  struct open_file_t *const o = fd_file(fd);
+  if (o == NULL) return -1;
+  lock();
+  const int ret = file_write(o, &o->pos, src, len);
+  unlock();
+  return ret;
+}
+int fs_lseek(int fd, long offset, int whence) {
+  struct open_file_t *const o = fd_file(fd);
+  if (o == NULL) return -1;
+  size_t base = 0;
+  if (whence == SEEK_CUR) {
+    base = o->pos;
+  } else if (whence == SEEK_END) {
+    FILE file;
+    lock();
+    root_fs.stat(&root_fs, &o->file, &file);
+    unlock();
+    base = file.size;
+  } else if (whence != SEEK_SET) {
+    return -1;
+  }
+  if (offset < 0 ? (size_t)-offset > base : base + offset > INT32_MAX) return -1;
+  o->pos = base + offset;
+  return o->pos;
+}
+struct open_file_t *fs_file_get(int fd) {
+  struct open_file_t *const o = fd_file(fd);
+  if (o != NULL) o->users++;
+  return o;
+}
+void fs_file_put(struct open_file_t *o) { o->users--; }
+int fs_file_read(struct open_file_t *o, void *dst, size_t offset, size_t len) {
+  lock();
+  const size_t done = file_read(o, dst, offset, len);
+  unlock();
+  if (done > 0) readahead(&o->ahead, offset, done);
+  return done;
+}
+int fs_file_write(struct open_file_t *o, size_t offset, const void *src, size_t len) {
+  lock();
+  const int ret = file_write(o, &offset, src, len);
+  unlock();
+  return ret;
+}
+void fs_fork_files(const struct process_t *parent, struct process_t *child) {
+  for (int fd = 0; fd < NBFILES; fd++) {
+    child->files[fd] = parent->files[fd];
+    if (child->files[fd] != NULL) child->files[fd]->users++;
+  }
+}
+void fs_close_files(struct process_t *ps) {
+  for (int fd = 0; fd < NBFILES; fd++) {
+    if (ps->files[fd] != NULL) ps->files[fd]->users--;
+    ps->files[fd] = NULL;
+  }
+}
+
+/** Report of a walk, see fs_frag_report */
+struct frag_walk_t {
+  bool relocate;
+  int moved;
+  struct volume_frag_t *volume;
+  struct file_frag_t *files;
+  size_t nfiles;
+};
+
+/** Called under lock on each regular file of the volume */
+static void frag_visit(struct frag_walk_t *w, const FILE *f) {
+  if (w->relocate) {
+    const int moved = root_fs.relocate(&root_fs, f);
+    if (moved > 0) {
+      // Cached entries and open file extents point to the old clusters
+      dcache_invalidate(f->parentCluster);
+      layout++;
+      w->moved += moved;
+    }
+  }
+  uint32_t clusters;
+  const int extents = root_fs.fragments(&root_fs, f, &clusters);
+  if (extents < 0) return;
+  if (w->volume->files < w->nfiles) {
+    struct file_frag_t *const r = &w->files[w->volume->files];
+    memcpy(r->name, f->name, sizeof(r->name));
+    r->clusters = clusters;
+    r->extents = extents;
+  }
+  w->volume->files++;
+  if (extents > 1) w->volume->fragmented++;
+  w->volume->clusters += clusters;
+  w->volume->extents += extents;
+}
+
+/** Visit files depth first, one directory entry per lock hold so other
+ * processes are not held up for the whole volume */
+static void frag_walk(struct frag_walk_t *w) {
+  DIR_CURSOR stack[FS_WALK_DEPTH];
+  int depth = 0;
+  memset(w->volume, 0, sizeof(*w->volume));
+  fs_opendir(fs_root(), &stack[0]);
+  while (depth >= 0) {
+    FILE f;
+    lock();
+    const int n = root_fs.readdir(&root_fs, &stack[depth], &f, 1);
+    if (n <= 0) {
+      unlock();
+      depth--;
+      continue;
+    }
+    if (!(f.attribs & FILE_DIRECTORY)) frag_visit(w, &f);
+    unlock();
+    if ((f.attribs & FILE_DIRECTORY) && strcmp(f.name, ".") != 0 && strcmp(f.name, "..") != 0 &&
+        depth + 1 < FS_WALK_DEPTH) {
+      const DIR dir = {.clusterIndex = f.clusterIndex};
+      fs_opendir(dir, &stack[++depth]);
+    }
+  }
+  lock();
+  w->volume->freeClusters = root_fs.space(&root_fs, &w->volume->freeRuns);
+  unlock();
+}
+
+int fs_frag_report(struct volume_frag_t *volume, struct file_frag_t *files, size_t nfiles) {
+  struct frag_walk_t w = {.relocate = false, .volume = volume, .files = files, .nfiles = nfiles};
+  frag_walk(&w);
+  return volume->files;
+}
+int fs_defrag(struct volume_frag_t *volume) {
+  struct frag_walk_t w = {.relocate = true, .volume = volume, .files = NULL, .nfiles = 0};
+  frag_walk(&w);
+  fs_sync();
+  return w.moved;
 }
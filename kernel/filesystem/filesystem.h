@@ -3,31 +3,128 @@
 
 #include "disk.h"
 #include "file.h"
+#include "stdbool.h"
+#include "system.h"
 
-/** Load floppy or init in memory */
+struct process_t;
+struct open_file_t;
+
+/** Load floppy or init in memory, behind a block cache */
 void setup_filesystem();
 
 /** Polymorphic filesystem. For function details see corresponding fs_ method */
 struct filesystem_t {
   struct disk_t* disk;
+  /** Mounted volume state */
+  void* arg;
   DIR (*root)(struct filesystem_t* self);
   int (*list)(struct filesystem_t *self, const DIR dir, FILE *files, size_t nfiles, size_t offset);
+  /** Find name in dir only. Return 0 or negative if not found */
+  int (*lookup)(struct filesystem_t *self, const DIR dir, const char *name, FILE *file);
+  void (*opendir)(struct filesystem_t *self, const DIR dir, DIR_CURSOR *cursor);
+  int (*readdir)(struct filesystem_t *self, DIR_CURSOR *cursor, FILE *files, size_t nfiles);
   void (*file_name)(struct filesystem_t *self, const FILE *f, char *name, size_t len);
   int (*read)(struct filesystem_t *self, void *dst, const FILE *f, size_t offset, size_t len);
+  /** Current size and first cluster of f in file */
+  void (*stat)(struct filesystem_t *self, const FILE *f, FILE *file);
+  /** Disk address of file data at offset in addr.
+   * Return length contiguous on disk, 0 past end of file */
+  size_t (*bmap)(struct filesystem_t *self, const FILE *f, size_t offset, addr_t *addr);
   int (*write)(struct filesystem_t *self, const FILE *f, size_t offset, const void *src, size_t len);
+  int (*create)(struct filesystem_t *self, const DIR dir, const char *name, FILE *file);
+  int (*truncate)(struct filesystem_t *self, const FILE *f, size_t size);
+  int (*unlink)(struct filesystem_t *self, const FILE *f);
+  /** Save metadata kept in memory */
+  void (*sync)(struct filesystem_t *self);
+  /** Return contiguous runs of f, and its allocation units in clusters */
+  int (*fragments)(struct filesystem_t *self, const FILE *f, uint32_t *clusters);
+  /** Move f data to one run. Return moved allocation units, 0 if f already
+   * is contiguous or -1 if no free run is large enough */
+  int (*relocate)(struct filesystem_t *self, const FILE *f);
+  /** Return free allocation units, and their runs count in runs */
+  uint32_t (*space)(struct filesystem_t *self, uint32_t *runs);
 };
 
 /** Get top level folder */
 DIR fs_root();
-/** Get file list in directory.
+/** Get file list in directory, skipping offset files.
  * Return error or number of files.
  * Takes an array of file_t */
 int fs_list(const DIR dir, FILE *files, size_t nfiles, size_t offset);
+/** Start listing dir */
+void fs_opendir(const DIR dir, DIR_CURSOR *cursor);
+/** Get next files of listing and move cursor past them.
+ * Return error or number of files, 0 at the end */
+int fs_readdir(DIR_CURSOR *cursor, FILE *files, size_t nfiles);
+/** Find file at path, relative to dir unless it starts with '/'.
+ * Return 0, -1 if not found or -2 if a component is not a directory */
+int fs_lookup(const DIR dir, const char *path, FILE *file);
 /** Get full filename. len does not include \0 */
 void fs_file_name(const FILE *f, char *name, size_t len);
-/** Read file part. Return error or readded size */
+/** Read file part. Sequential reads get following data prefetched in the
+ * background. Return error or readded size */
 int fs_read(void *dst, const FILE *f, size_t offset, size_t len);
-/** Write file part. Return error or written size */
+/** Write file part. Writing at the end of file appends to it.
+ * Return error or written size */
 int fs_write(const FILE *f, size_t offset, const void *src, size_t len);
+/** Create empty file name in dir. Name must fit 8.3, as no long name is
+ * written. Return 0, -1 on error or -3 if name already exists */
+int fs_create(const DIR dir, const char *name, FILE *file);
+/** Shrink file to size. Return error or 0 */
+int fs_truncate(const FILE *f, size_t size);
+/** Remove file, directories and files open through a descriptor are
+ * refused. Return error or 0 */
+int fs_unlink(const FILE *f);
+/** Write back file metadata and cached disk blocks */
+void fs_sync();
+/** Get disk block cache usage */
+void fs_cache_status(struct disk_cache_status_t *status);
+
+/** Open file at path, relative to dir unless it starts with '/', with
+ * file_open_flags. Return descriptor of current process, -1 on error or -2
+ * if path or a component is a directory, resp. not a directory */
+int fs_open(const DIR dir, const char *path, int flags);
+/** Release descriptor. Return error or 0 */
+int fs_close(int fd);
+/** Read from descriptor position and move it. Sequential reads get
+ * following data prefetched in the background. Return error or readded size */
+int fs_fread(int fd, void *dst, size_t len);
+/** Write len bytes from descriptor position to the console, without
+ * copying them out of the block cache, and move the position.
+ * Return error or written size */
+int fs_sendfile(int fd, size_t len);
+/** Write at descriptor position and move it. Return error or written size */
+int fs_fwrite(int fd, const void *src, size_t len);
+/** Move descriptor position to offset from whence (see file_seek).
+ * Return new position or error */
+int fs_lseek(int fd, long offset, int whence);
+/** Hold the open file of descriptor fd, which stays valid once the
+ * descriptor is closed. Return NULL if fd is not open */
+struct open_file_t *fs_file_get(int fd);
+/** Release a file held by fs_file_get */
+void fs_file_put(struct open_file_t *file);
+/** fs_fread at offset, leaving the descriptor position alone */
+int fs_file_read(struct open_file_t *file, void *dst, size_t offset, size_t len);
+/** fs_fwrite at offset, unless the file was opened for appending */
+int fs_file_write(struct open_file_t *file, size_t offset, const void *src, size_t len);
+/** Share open files of parent with child */
+void fs_fork_files(const struct process_t *parent, struct process_t *child);
+/** Release all descriptors of ps */
+void fs_close_files(struct process_t *ps);
+/** Whether the running process is inside a filesystem call, which it
+ * can not reenter */
+bool fs_lock_held();
+/** Let others use the filesystem, its cache and disk if ps, being stopped,
+ * was inside a call */
+void fs_release_lock(const struct process_t *ps);
+
+/** Fill volume, and files with the first nfiles regular files found.
+ * Return the count of regular files */
+int fs_frag_report(struct volume_frag_t *volume, struct file_frag_t *files, size_t nfiles);
+/** Move each fragmented file to the first free run holding it, so files
+ * are contiguous and packed from the start of the volume. Directories stay
+ * in place, as do files no free run can hold. Fill volume with the result.
+ * Return moved allocation units */
+int fs_defrag(struct volume_frag_t *volume);
 
 #endif /*FILESYSTEM_H_*/
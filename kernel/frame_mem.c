@@ -0,0 +1,123 @@
+#include "frame_mem.h"
+
+#include "boot/multiboot.h"
+#include "buddy.h"
+#include "debug.h"
+#include "mem.h"
+#include "start.h"
+#include "stddef.h"
+#include "stdio.h"
+
+/** Frames start after the user image and heap, where user stacks were
+ * allocated. Must be aligned on the largest block */
+#define FRAME_MEM_START ((uint32_t)user_stack_heap)
+/** Physical memory reachable through the kernel direct map */
+#define FRAME_MEM_LIMIT 0x38000000u
+
+extern char user_stack_heap[];
+
+uint32_t frame_mem_end = 0;
+
+static struct buddy_t frames;
+/** Mappings of each single frame, for pages shared after fork */
+static uint16_t *frame_refs = NULL;
+
+#define FRAME_INDEX(phys) (((phys) - FRAME_MEM_START) >> FRAME_SHIFT)
+
+uint32_t frame_alloc(unsigned order) {
+  const uint32_t phys = buddy_alloc(&frames, order);
+  if (phys != 0 && order == 0) frame_refs[FRAME_INDEX(phys)] = 1;
+  return phys;
+}
+
+void frame_free(uint32_t phys, unsigned order) {
+  assert(phys >= FRAME_MEM_START && phys < frame_mem_end);
+  buddy_free(&frames, phys, order);
+}
+
+void frame_get(uint32_t phys) {
+  assert(phys >= FRAME_MEM_START && phys < frame_mem_end);
+  assert(frame_refs[FRAME_INDEX(phys)] > 0 && frame_refs[FRAME_INDEX(phys)] < UINT16_MAX);
+  frame_refs[FRAME_INDEX(phys)]++;
+}
+
+void frame_put(uint32_t phys) {
+  assert(phys >= FRAME_MEM_START && phys < frame_mem_end);
+  assert(frame_refs[FRAME_INDEX(phys)] > 0);
+  if (--frame_refs[FRAME_INDEX(phys)] == 0) buddy_free(&frames, phys, 0);
+}
+
+unsigned frame_refcount(uint32_t phys) {
+  assert(phys >= FRAME_MEM_START && phys < frame_mem_end);
+  return frame_refs[FRAME_INDEX(phys)];
+}
+
+unsigned frame_order(unsigned long length) {
+  unsigned order = 0;
+  while (((unsigned long)FRAME_SIZE << order) < length && order <= FRAME_MAX_ORDER) order++;
+  return order;
+}
+
+void frame_mem_status(unsigned long *total, unsigned long *free) {
+  *total = frames.total;
+  *free = frames.free;
+}
+
+static void add_region(uint32_t start, uint32_t end) {
+  buddy_add(&frames, start, end);
+}
+
+/** Call fn on each usable RAM region below FRAME_MEM_LIMIT */
+static void foreach_region(void (*fn)(uint32_t start, uint32_t end)) {
+  const struct multiboot_info *const mbi = multiboot_info;
+  if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+    // Only the memory the kernel was linked for
+    fn(0, (uint32_t)user_end);
+    return;
+  }
+  if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+    uint32_t p = mbi->mmap_addr;
+    while (p < mbi->mmap_addr + mbi->mmap_length) {
+      const struct multiboot_mmap_entry *const e = (const struct multiboot_mmap_entry *)p;
+      if (e->type == MULTIBOOT_MEMORY_AVAILABLE && e->addr < FRAME_MEM_LIMIT) {
+        uint64_t end = e->addr + e->len;
+        if (end > FRAME_MEM_LIMIT) end = FRAME_MEM_LIMIT;
+        fn((uint32_t)e->addr, (uint32_t)end);
+      }
+      p += e->size + sizeof(e->size);
+    }
+  } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+    uint64_t end = 0x100000 + (uint64_t)mbi->mem_upper * 1024;
+    if (end > FRAME_MEM_LIMIT) end = FRAME_MEM_LIMIT;
+    fn(0x100000, (uint32_t)end);
+  } else {
+    fn(0, (uint32_t)user_end);
+  }
+}
+
+static void find_end(uint32_t start, uint32_t end) {
+  (void)start;
+  if (end > frame_mem_end) frame_mem_end = end;
+}
+
+void setup_frame_mem(void) {
+  assert((FRAME_MEM_START & ((FRAME_SIZE << FRAME_MAX_ORDER) - 1)) == 0);
+  frame_mem_end = 0;
+  foreach_region(find_end);
+  frame_mem_end &= ~(FRAME_SIZE - 1);
+  if (frame_mem_end <= FRAME_MEM_START) {
+    printf("Not enough memory for page frames\n");
+    frame_mem_end = FRAME_MEM_START;
+    return;
+  }
+
+  const unsigned long nframes = (frame_mem_end - FRAME_MEM_START) >> FRAME_SHIFT;
+  struct buddy_block_t *const blocks = mem_alloc(nframes * sizeof(struct buddy_block_t));
+  frame_refs = mem_alloc(nframes * sizeof(uint16_t));
+  assert(blocks != NULL && frame_refs != NULL);
+  buddy_init(&frames, FRAME_MEM_START, nframes, FRAME_SHIFT, FRAME_MAX_ORDER, blocks);
+  foreach_region(add_region);
+
+  printf("Memory: %lu MiB, %lu MiB of page frames\n", (unsigned long)(frame_mem_end >> 20),
+         frames.total >> (20 - FRAME_SHIFT));
+}
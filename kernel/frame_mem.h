@@ -0,0 +1,38 @@
+/*
+ * Physical page frame allocator.
+ *
+ * Binary buddy system over all usable RAM reported by the boot loader,
+ * except the low memory, kernel and user image.
+ */
+#ifndef __FRAME_MEM_H__
+#define __FRAME_MEM_H__
+
+#include "stdint.h"
+
+#define FRAME_SIZE 4096
+#define FRAME_SHIFT 12
+/** Largest block is 4M (2^10 frames) */
+#define FRAME_MAX_ORDER 10
+
+/** End of managed physical memory */
+extern uint32_t frame_mem_end;
+
+/** Parse multiboot memory map and release usable frames */
+void setup_frame_mem(void);
+
+/** Allocate 2^order contiguous frames. Returns physical address or 0 */
+uint32_t frame_alloc(unsigned order);
+/** Release a block from frame_alloc with the same order */
+void frame_free(uint32_t phys, unsigned order);
+/** Single frames are reference counted: frame_alloc(0) sets one reference,
+ * frame_put releases the frame with the last one */
+void frame_get(uint32_t phys);
+void frame_put(uint32_t phys);
+unsigned frame_refcount(uint32_t phys);
+/** Smallest order of a block with at least length bytes */
+unsigned frame_order(unsigned long length);
+
+/** Get managed and free frames count */
+void frame_mem_status(unsigned long *total, unsigned long *free);
+
+#endif
@@ -0,0 +1,127 @@
+#include "ipc.h"
+
+#include "stddef.h"
+#include "stdio.h"
+
+/** Add calling process to server waiting list by priority */
+static void push_sender(struct process_t *server, struct process_t *ps) {
+  assert(ps->state == PS_IPC_SEND);
+  struct process_t **cur = &server->ipc_senders;
+  while (*cur != NULL && ps->prio <= (*cur)->prio) {
+    cur = &(*cur)->state_attr.ipc.next;
+  }
+  ps->state_attr.ipc.next = *cur;
+  *cur = ps;
+}
+/** Remove calling process from server waiting list */
+static void pop_sender(struct process_t *server, struct process_t *ps) {
+  struct process_t **cur = &server->ipc_senders;
+  while (*cur != NULL && *cur != ps) {
+    cur = &(*cur)->state_attr.ipc.next;
+  }
+  if (*cur != NULL) *cur = ps->state_attr.ipc.next;
+}
+
+/** Move first caller from server list to PS_IPC_REPLY. Returns its pid */
+static int accept_sender(struct process_t *server, struct ipc_msg_t *message) {
+  struct process_t *const client = server->ipc_senders;
+  assert(client != NULL && client->state == PS_IPC_SEND);
+  server->ipc_senders = client->state_attr.ipc.next;
+  if (message != NULL) *message = *client->state_attr.ipc.message;
+  client->state = PS_IPC_REPLY;
+  return client->pid;
+}
+
+int ipc_call(int pid, const struct ipc_msg_t *message, struct ipc_msg_t *reply) {
+  if (pid < 0 || pid >= NBPROC) return -1;
+  struct process_t *const ps = getproc();
+  struct process_t *const server = &processes[pid];
+  if (server->state < PS_RUNNABLE || server == ps) return -1;
+
+  int retval = 0;
+  struct ipc_msg_t buffer = *message;
+  remove_runnable(ps);
+  ps->state_attr.ipc.peer = pid;
+  ps->state_attr.ipc.message = &buffer;
+  ps->state_attr.ipc.retval = &retval;
+  if (server->state == PS_IPC_RECEIVE) {
+    // Server already waits: deliver and run it in place of the caller
+    ps->state = PS_IPC_REPLY;
+    if (server->state_attr.ipc.message != NULL)
+      *server->state_attr.ipc.message = buffer;
+    *server->state_attr.ipc.retval = ps->pid;
+    handoff(server);
+  } else {
+    ps->state = PS_IPC_SEND;
+    push_sender(server, ps);
+    tick_scheduler();
+  }
+  // NOTE: server writes reply in buffer
+  if (retval == 0 && reply != NULL) *reply = buffer;
+  return retval;
+}
+
+int ipc_reply_wait(int client, const struct ipc_msg_t *reply, struct ipc_msg_t *message) {
+  struct process_t *const ps = getproc();
+  struct process_t *replied = NULL;
+  if (client != NOPID) {
+    if (client < 0 || client >= NBPROC) return -1;
+    struct process_t *const c = &processes[client];
+    if (c->state == PS_IPC_REPLY && c->state_attr.ipc.peer == ps->pid) {
+      if (reply != NULL) *c->state_attr.ipc.message = *reply;
+      *c->state_attr.ipc.retval = 0;
+      replied = c;
+    }
+  }
+
+  if (ps->ipc_senders != NULL) {
+    // Next call already pending: no need to block
+    const int pid = accept_sender(ps, message);
+    if (replied != NULL) {
+      push_runnable(replied);
+      fix_scheduler();
+    }
+    return pid;
+  }
+
+  int caller = NOPID;
+  remove_runnable(ps);
+  ps->state = PS_IPC_RECEIVE;
+  ps->state_attr.ipc.peer = NOPID;
+  ps->state_attr.ipc.message = message;
+  ps->state_attr.ipc.retval = &caller;
+  if (replied != NULL) {
+    handoff(replied);
+  } else {
+    tick_scheduler();
+  }
+  // NOTE: caller writes its pid in caller
+  return caller;
+}
+
+void ipc_reorder_process(struct process_t *ps) {
+  assert(ps->state == PS_IPC_SEND);
+  struct process_t *const server = &processes[ps->state_attr.ipc.peer];
+  pop_sender(server, ps);
+  push_sender(server, ps);
+}
+
+void ipc_remove_process(struct process_t *ps) {
+  if (ps->state == PS_IPC_SEND) {
+    pop_sender(&processes[ps->state_attr.ipc.peer], ps);
+  }
+  // Wake up every client of this server with an error
+  while (ps->ipc_senders != NULL) {
+    struct process_t *const c = ps->ipc_senders;
+    ps->ipc_senders = c->state_attr.ipc.next;
+    *c->state_attr.ipc.retval = -2;
+    push_runnable(c);
+  }
+  for (int i = 0; i < NBPROC; i++) {
+    struct process_t *const c = &processes[i];
+    if (c->state == PS_IPC_REPLY && c->state_attr.ipc.peer == ps->pid) {
+      *c->state_attr.ipc.retval = -2;
+      push_runnable(c);
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef IPC_H_
+#define IPC_H_
+
+#include "scheduler.h"
+#include "system.h"
+
+/** Synchronous rendezvous with process pid (L4 like call).
+    Sends "message" and waits for "reply" (may be NULL).
+    Switches directly to the server if it is already waiting.
+    Returns 0 or negative if invalid pid or server ended before reply */
+int ipc_call(int pid, const struct ipc_msg_t *message, struct ipc_msg_t *reply);
+
+/** Replies to "client" (if not NOPID) then waits next call in "message".
+    A reply to a process which is not waiting it is dropped.
+    Switches directly to the client if no call is pending.
+    Returns calling process pid or negative on error */
+int ipc_reply_wait(int client, const struct ipc_msg_t *reply, struct ipc_msg_t *message);
+
+/** Update server waiting list order after priority change */
+void ipc_reorder_process(struct process_t *process);
+/** Detach process from rendezvous before its end */
+void ipc_remove_process(struct process_t *process);
+
+#endif /*IPC_H_*/
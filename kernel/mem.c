@@ -4,6 +4,66 @@
  * Kernel memory allocator.
  */
 #include "mem.h"
+#include "frame_mem.h"
+#include "paging.h"
+#include "serial.h"
+#include "stddef.h"
+#include "stdio.h"
+#include "system.h"
+
+/* Once mem_heap_end is reached, the heap grows from page frames */
+#define HAVE_MMAP 1
+#define HAVE_MREMAP 0
+#define LACKS_FCNTL_H
+#define LACKS_SYS_MMAN_H
+#define MAP_PRIVATE 0
+#define MAP_ANONYMOUS 0
+#define PROT_READ 0
+#define PROT_WRITE 0
+static void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+static int munmap(void *addr, size_t length);
+
+/* Account kernel blocks per mem_alloc caller */
+#define MEM_SITES 128
 
 #define USE_THIS_CUSTOM_PREFIX k
 #include "malloc.c.h"
+
+static void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset)
+{
+	(void)addr; (void)prot; (void)flags; (void)fd; (void)offset;
+	const uint32_t phys = frame_alloc(frame_order(length));
+	if (phys == 0) return (void *)MORECORE_FAILURE;
+	memset(P2V(phys), 0, length);
+	return P2V(phys);
+}
+
+static int munmap(void *addr, size_t length)
+{
+	frame_free(V2P(addr), frame_order(length));
+	return 0;
+}
+
+void *mem_alloc_aligned(unsigned long alignment, unsigned long length)
+{
+	return public_mEMALIGn(alignment, length);
+}
+
+void mem_free_aligned(void *zone)
+{
+	public_fREe(zone);
+}
+
+void meminfo(struct meminfo_t *info)
+{
+	frame_mem_status(&info->frames, &info->free_frames);
+	mem_heap_status(&info->heap);
+}
+
+int mem_leak_report(void)
+{
+	serial_puts("kernel heap leak report\n");
+	const int n = mem_heap_leaks(serial_puts);
+	serial_puts("end of leak report\n");
+	return n;
+}
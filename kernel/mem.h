@@ -6,7 +6,29 @@
 #ifndef __MEM_H__
 #define __MEM_H__
 
+struct heap_status_t;
+struct heap_site_t;
+struct meminfo_t;
+
 void *mem_alloc(unsigned long length);
 void mem_free(void *zone, unsigned long length);
 
+/** Allocate length bytes aligned on alignment (power of 2), without guards */
+void *mem_alloc_aligned(unsigned long alignment, unsigned long length);
+/** Release zone from mem_alloc_aligned */
+void mem_free_aligned(void *zone);
+
+/** Kernel heap usage */
+void mem_heap_status(struct heap_status_t *status);
+/** Get N first allocation sites with the most live bytes or blocks
+ * (HEAP_SITES_BY_*). Returns sites count */
+int mem_heap_sites(struct heap_site_t *sites, int count, int order);
+/** Give a line per site with live blocks. Returns sites count */
+int mem_heap_leaks(void (*line)(const char *));
+
+/** Page frames and kernel heap usage */
+void meminfo(struct meminfo_t *info);
+/** Dump sites with live blocks over serial. Returns sites count */
+int mem_leak_report(void);
+
 #endif
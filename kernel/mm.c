@@ -0,0 +1,150 @@
+#include "mm.h"
+
+#include "boot/processor_structs.h"
+#include "cpu.h"
+#include "debug.h"
+#include "frame_mem.h"
+#include "paging.h"
+#include "slab.h"
+#include "start.h"
+#include "stddef.h"
+#include "string.h"
+#include "system.h"
+
+extern char user_stack_heap[];
+
+static struct slab_cache_t mm_cache;
+
+/** Page directory entries owned by each address space: stacks and heaps */
+static int private_pde(unsigned pde) {
+  return (pde >= PDE_INDEX(user_stack_heap) && pde <= PDE_INDEX(user_end - 1)) ||
+         (pde >= PDE_INDEX(USER_HEAP_BASE) && pde < PDE_INDEX(PHYS_OFFSET));
+}
+
+void setup_mm(void) {
+  slab_cache_init(&mm_cache, "mm", sizeof(struct mm_t), sizeof(uint32_t), NULL);
+}
+
+struct mm_t *mm_create(void) {
+  struct mm_t *const mm = slab_alloc(&mm_cache);
+  if (mm == NULL) return NULL;
+  const uint32_t phys = frame_alloc(0);
+  if (phys == 0) {
+    slab_free(&mm_cache, mm);
+    return NULL;
+  }
+  mm->pgdir = P2V(phys);
+  mm->cr3 = phys;
+  mm->users = 1;
+  mm->heap_slots = 0;
+  memset(mm->maps, 0, sizeof(mm->maps));
+  for (unsigned i = 0; i < 1024; i++) mm->pgdir[i] = private_pde(i) ? 0 : pgdir[i];
+  return mm;
+}
+
+static void mm_destroy(struct mm_t *mm) {
+  // Exiting process still runs on it until the next switch
+  if (get_cr3() == mm->cr3) mm_switch(NULL);
+  for (unsigned i = 0; i < 1024; i++) {
+    const uint32_t pde = mm->pgdir[i];
+    if (!private_pde(i) || !(pde & PG_PRESENT)) continue;
+    const uint32_t *const table = P2V(PG_FRAME(pde));
+    for (unsigned j = 0; j < 1024; j++) {
+      if (table[j] & PG_PRESENT) frame_put(PG_FRAME(table[j]));
+    }
+    frame_put(PG_FRAME(pde));
+  }
+  frame_put(mm->cr3);
+  slab_free(&mm_cache, mm);
+}
+
+struct mm_t *mm_fork(struct mm_t *parent, int heap_slot) {
+  assert(parent != NULL);
+  struct mm_t *const mm = mm_create();
+  if (mm == NULL) return NULL;
+  if (heap_slot >= 0) mm->heap_slots = 1u << heap_slot;
+  for (int i = 0; i < MM_FILE_MAPS; i++) {
+    mm->maps[i] = parent->maps[i];
+    if (mm->maps[i].length != 0) mm->heap_slots |= 1u << mm->maps[i].slot;
+  }
+  for (unsigned i = 0; i < 1024; i++) {
+    const uint32_t pde = parent->pgdir[i];
+    if (!private_pde(i) || !(pde & PG_PRESENT)) continue;
+    const uint32_t phys = frame_alloc(0);
+    if (phys == 0) {
+      // Parent pages already made copy-on-write get back their frame on write
+      mm_put(mm);
+      return NULL;
+    }
+    uint32_t *const from = P2V(PG_FRAME(pde));
+    uint32_t *const to = P2V(phys);
+    for (unsigned j = 0; j < 1024; j++) {
+      uint32_t pte = from[j];
+      if (pte & PG_PRESENT) {
+        if (pte & PG_WRITE) pte = (pte & ~PG_WRITE) | PG_COW;
+        from[j] = pte;
+        frame_get(PG_FRAME(pte));
+      }
+      to[j] = pte;
+    }
+    mm->pgdir[i] = phys | (pde & (PAGE_SIZE - 1));
+  }
+  // Parent pages are now read-only
+  if (get_cr3() == parent->cr3) set_cr3(parent->cr3);
+  return mm;
+}
+
+void mm_get(struct mm_t *mm) {
+  if (mm != NULL) mm->users++;
+}
+
+void mm_put(struct mm_t *mm) {
+  if (mm == NULL) return;
+  assert(mm->users > 0);
+  if (--mm->users == 0) mm_destroy(mm);
+}
+
+uint32_t *mm_dir(const struct mm_t *mm) {
+  return mm != NULL ? mm->pgdir : pgdir;
+}
+
+void mm_switch(const struct mm_t *mm) {
+  const uint32_t cr3 = mm != NULL ? mm->cr3 : (uint32_t)pgdir;
+  tss.cr3 = cr3;
+  if (get_cr3() != cr3) set_cr3(cr3);
+}
+
+int mm_heap_slot_alloc(struct mm_t *mm) {
+  for (int slot = 0; slot < MM_HEAP_SLOTS; slot++) {
+    if (!(mm->heap_slots & (1u << slot))) {
+      mm->heap_slots |= 1u << slot;
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void mm_heap_slot_free(struct mm_t *mm, int slot) {
+  assert(mm->heap_slots & (1u << slot));
+  mm->heap_slots &= ~(1u << slot);
+}
+
+int mm_cow_fault(struct mm_t *mm, void *addr) {
+  uint32_t *const dir = mm_dir(mm);
+  uint32_t *const pte = paging_pte(dir, addr);
+  if (pte == NULL || !(*pte & PG_COW)) return -1;
+  const uint32_t old = PG_FRAME(*pte);
+  const uint32_t flags = (*pte & (PAGE_SIZE - 1) & ~PG_COW) | PG_WRITE;
+  if (frame_refcount(old) == 1) {
+    // Other copies are gone
+    *pte = old | flags;
+  } else {
+    const uint32_t phys = frame_alloc(0);
+    if (phys == 0) return -1;
+    memcpy(P2V(phys), P2V(old), PAGE_SIZE);
+    *pte = phys | flags;
+    frame_put(old);
+  }
+  paging_invalidate(dir, addr);
+  return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * User address spaces.
+ *
+ * Each address space has its own page directory. The kernel, the user image
+ * and the USER_INFO page are shared with the kernel page directory, while
+ * the user stacks window and the heap slots are private. Processes started
+ * by a user process share its address space; fork copies it on write.
+ * Kernel processes use the kernel page directory, as a NULL address space.
+ */
+#ifndef __MM_H__
+#define __MM_H__
+
+#include "stdint.h"
+#include "file.h"
+
+/** File range mapped in a heap slot, see file_map.h */
+struct mm_file_map_t {
+  /** Mapped bytes, 0 if unused */
+  uint32_t length;
+  int slot;
+  /** File offset of the first page */
+  uint32_t offset;
+  FILE file;
+};
+
+/** File mappings per address space */
+#define MM_FILE_MAPS 4
+
+struct mm_t {
+  /** Page directory, through the direct map */
+  uint32_t *pgdir;
+  /** Physical address of pgdir */
+  uint32_t cr3;
+  /** Processes using this address space */
+  int users;
+  /** Bitmap of used heap slots */
+  uint32_t heap_slots;
+  struct mm_file_map_t maps[MM_FILE_MAPS];
+};
+
+/** Heap slots between USER_HEAP_BASE and the direct map */
+#define MM_HEAP_SLOTS 32
+
+void setup_mm(void);
+
+/** Empty address space with one user. Returns NULL if out of memory */
+struct mm_t *mm_create(void);
+/** Copy of mm with one user: private pages are shared read-only by both
+ * until written. Only heap_slot, if not -1, and file mappings stay in use
+ * in the copy. Returns NULL if out of memory */
+struct mm_t *mm_fork(struct mm_t *mm, int heap_slot);
+void mm_get(struct mm_t *mm);
+/** Release one user. The last one frees all private pages */
+void mm_put(struct mm_t *mm);
+
+/** Page directory of mm */
+uint32_t *mm_dir(const struct mm_t *mm);
+/** Load mm, and keep it in the task state for returns from trap tasks */
+void mm_switch(const struct mm_t *mm);
+
+/** Reserve a heap slot. Returns its index or -1 */
+int mm_heap_slot_alloc(struct mm_t *mm);
+void mm_heap_slot_free(struct mm_t *mm, int slot);
+
+/** Give a private copy of the copy-on-write page at addr. Returns -1 if
+ * addr is not copy-on-write or out of memory */
+int mm_cow_fault(struct mm_t *mm, void *addr);
+
+#endif
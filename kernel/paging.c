@@ -0,0 +1,182 @@
+#include "paging.h"
+
+#include "cpu.h"
+#include "debug.h"
+#include "frame_mem.h"
+#include "mem.h"
+#include "start.h"
+#include "string.h"
+
+#define PG_LARGE_FRAME(e) ((e) & ~(LARGE_PAGE_SIZE - 1))
+
+/** CPUID.1:EDX features. Cf. Intel Architecture Software Developer's Manual Volume 2 */
+#define CPUID_PSE (1 << 3)
+#define CPUID_PGE (1 << 13)
+#define CR4_PSE (1 << 4)
+#define CR4_PGE (1 << 7)
+
+/** Built by crt0. The static page tables identity map the first 48M */
+extern uint32_t pgtab[];
+extern char user_stack_heap[];
+extern char _rodata_start[];
+extern char _rodata_end[];
+
+/** PG_GLOBAL if supported */
+static uint32_t global_flag = 0;
+
+__inline__ static void invlpg(const void *va) {
+  __asm__ __volatile__("invlpg (%0)" ::"r"(va) : "memory");
+}
+__inline__ static void flush_tlb(void) {
+  __asm__ __volatile__("movl %%cr3,%%eax\n\tmovl %%eax,%%cr3" ::: "eax", "memory");
+}
+
+/** Whether dir is the loaded page directory. The static one is identity mapped */
+static int is_current(const uint32_t *dir) {
+  const uint32_t phys = (uint32_t)dir >= PHYS_OFFSET ? V2P(dir) : (uint32_t)dir;
+  return phys == get_cr3();
+}
+
+/** Page table covering va. Allocated from frames if create */
+static uint32_t *page_table(uint32_t *dir, const void *va, int create, unsigned flags) {
+  uint32_t *const pde = &dir[PDE_INDEX(va)];
+  if (*pde & PG_LARGE) {
+    assert(!create);
+    return NULL;
+  }
+  if (!(*pde & PG_PRESENT)) {
+    if (!create) return NULL;
+    const uint32_t phys = frame_alloc(0);
+    if (phys == 0) return NULL;
+    memset(P2V(phys), 0, PAGE_SIZE);
+    *pde = phys | PG_PRESENT | PG_WRITE | (flags & PG_USER);
+  }
+  return P2V(PG_FRAME(*pde));
+}
+
+/** Kernel page directory entries which can use a 4M page: no null page,
+ * no .rodata and no user pages */
+static int kernel_large_pde(unsigned pde) {
+  return pde > 0 && pde < PDE_INDEX(user_start) &&
+         (pde < PDE_INDEX(_rodata_start) || pde > PDE_INDEX(_rodata_end - 1));
+}
+
+void setup_paging(void) {
+  unsigned eax, ebx, ecx, edx;
+  cpuid(1, &eax, &ebx, &ecx, &edx);
+  const int large = (edx & CPUID_PSE) != 0;
+  if (edx & CPUID_PGE) global_flag = PG_GLOBAL;
+  if (large) set_cr4(get_cr4() | CR4_PSE);
+
+  // Kernel identity map
+  for (uint32_t va = 0; va < (uint32_t)user_start; va += PAGE_SIZE) {
+    if (pgtab[va >> PAGE_SHIFT] & PG_PRESENT) pgtab[va >> PAGE_SHIFT] |= global_flag;
+  }
+  for (unsigned pde = 0; large && pde < PDE_INDEX(user_start); pde++) {
+    if (kernel_large_pde(pde)) {
+      pgdir[pde] = (pde << 22) | PG_PRESENT | PG_WRITE | PG_LARGE | global_flag;
+    }
+  }
+
+  uint32_t end = frame_mem_end;
+  if (end < (uint32_t)user_end) end = (uint32_t)user_end;
+  for (uint32_t phys = 0; phys < end; phys += LARGE_PAGE_SIZE) {
+    if (large) {
+      pgdir[PDE_INDEX(P2V(phys))] = phys | PG_PRESENT | PG_WRITE | PG_LARGE | global_flag;
+      continue;
+    }
+    // Direct map tables come from the kernel heap, which is identity mapped
+    uint32_t *const table = mem_alloc_aligned(PAGE_SIZE, PAGE_SIZE);
+    assert(table != NULL);
+    for (unsigned i = 0; i < 1024; i++) {
+      const uint32_t p = phys + i * PAGE_SIZE;
+      table[i] = p < end ? p | PG_PRESENT | PG_WRITE | global_flag : 0;
+    }
+    pgdir[PDE_INDEX(P2V(phys))] = (uint32_t)table | PG_PRESENT | PG_WRITE;
+  }
+
+  // User stacks window is now backed by frames on demand
+  for (uint32_t va = (uint32_t)user_stack_heap; va < (uint32_t)user_end; va += PAGE_SIZE) {
+    pgtab[va >> PAGE_SHIFT] = 0;
+  }
+  flush_tlb();
+  // Enabling global pages flushes them too
+  if (global_flag) set_cr4(get_cr4() | CR4_PGE);
+}
+
+int paging_map(uint32_t *dir, void *virt, uint32_t phys, unsigned flags) {
+  uint32_t *const table = page_table(dir, virt, 1, flags);
+  if (table == NULL) return -1;
+  table[PTE_INDEX(virt)] = PG_FRAME(phys) | flags | PG_PRESENT;
+  if (is_current(dir)) invlpg(virt);
+  return 0;
+}
+
+uint32_t paging_unmap(uint32_t *dir, void *virt) {
+  uint32_t *const table = page_table(dir, virt, 0, 0);
+  if (table == NULL || !(table[PTE_INDEX(virt)] & PG_PRESENT)) return 0;
+  const uint32_t phys = PG_FRAME(table[PTE_INDEX(virt)]);
+  table[PTE_INDEX(virt)] = 0;
+  if (is_current(dir)) invlpg(virt);
+  return phys;
+}
+
+uint32_t paging_lookup(const uint32_t *dir, const void *virt, unsigned *flags) {
+  const uint32_t pde = dir[PDE_INDEX(virt)];
+  if (!(pde & PG_PRESENT)) return 0;
+  if (pde & PG_LARGE) {
+    if (flags != NULL) *flags = pde & (PAGE_SIZE - 1);
+    return PG_LARGE_FRAME(pde) + PG_FRAME((uint32_t)virt & (LARGE_PAGE_SIZE - 1));
+  }
+  const uint32_t pte = ((uint32_t *)P2V(PG_FRAME(pde)))[PTE_INDEX(virt)];
+  if (!(pte & PG_PRESENT)) return 0;
+  // User and write access need both levels
+  if (flags != NULL) *flags = pte & pde & (PAGE_SIZE - 1);
+  return PG_FRAME(pte);
+}
+
+uint32_t *paging_pte(uint32_t *dir, const void *virt) {
+  uint32_t *const table = page_table(dir, virt, 0, 0);
+  if (table == NULL || !(table[PTE_INDEX(virt)] & PG_PRESENT)) return NULL;
+  return &table[PTE_INDEX(virt)];
+}
+
+void paging_invalidate(const uint32_t *dir, const void *virt) {
+  if (is_current(dir)) invlpg(virt);
+}
+
+int paging_map_range(uint32_t *dir, void *start, void *end, unsigned flags) {
+  for (char *va = (char *)PG_FRAME((uint32_t)start); va < (char *)end; va += PAGE_SIZE) {
+    if (paging_lookup(dir, va, NULL) != 0) continue;
+    const uint32_t phys = frame_alloc(0);
+    if (phys == 0) return -1;
+    memset(P2V(phys), 0, PAGE_SIZE);
+    if (paging_map(dir, va, phys, flags) < 0) {
+      frame_put(phys);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void paging_unmap_range(uint32_t *dir, void *start, void *end) {
+  for (char *va = (char *)PG_FRAME((uint32_t)start); va < (char *)end; va += PAGE_SIZE) {
+    // Skip whole missing page tables
+    if (!(dir[PDE_INDEX(va)] & PG_PRESENT)) {
+      va = (char *)(PG_LARGE_FRAME((uint32_t)va) + LARGE_PAGE_SIZE - PAGE_SIZE);
+      continue;
+    }
+    const uint32_t phys = paging_unmap(dir, va);
+    if (phys != 0) frame_put(phys);
+  }
+}
+
+int paging_is_user(const uint32_t *dir, const void *virt) {
+  unsigned flags;
+  return paging_lookup(dir, virt, &flags) != 0 && (flags & PG_USER);
+}
+int paging_is_user_writable(const uint32_t *dir, const void *virt) {
+  unsigned flags;
+  return paging_lookup(dir, virt, &flags) != 0 && (flags & PG_USER) &&
+         (flags & (PG_WRITE | PG_COW));
+}
@@ -0,0 +1,69 @@
+/*
+ * Page tables management.
+ *
+ * Physical memory managed by frame_mem is reachable by the kernel through a
+ * direct map at PHYS_OFFSET. Page tables are referenced by physical address.
+ * Functions work on any page directory, given by its kernel address.
+ */
+#ifndef __PAGING_H__
+#define __PAGING_H__
+
+#include "stdint.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+/** Virtual address of physical address 0 in the direct map */
+#define PHYS_OFFSET 0xC0000000u
+#define P2V(pa) ((void *)((uint32_t)(pa) + PHYS_OFFSET))
+#define V2P(va) ((uint32_t)(va) - PHYS_OFFSET)
+
+/** Page table entry flags. Cf. 3.7.6 Intel Architecture Software Developer's Manual Volume 3 */
+#define PG_PRESENT 0x001
+#define PG_WRITE 0x002
+#define PG_USER 0x004
+/** 4M page, in a page directory entry */
+#define PG_LARGE 0x080
+/** Not flushed from TLB on CR3 load */
+#define PG_GLOBAL 0x100
+
+/** Available to software: read-only page shared until first write */
+#define PG_COW 0x200
+
+#define LARGE_PAGE_SIZE 0x400000
+
+#define PDE_INDEX(va) ((uint32_t)(va) >> 22)
+#define PTE_INDEX(va) (((uint32_t)(va) >> PAGE_SHIFT) & 0x3ff)
+#define PG_FRAME(e) ((e) & ~(PAGE_SIZE - 1))
+
+/** Kernel page directory, built by crt0. Its kernel entries are shared by
+ * every address space */
+extern uint32_t pgdir[];
+
+/** Build the direct map and unmap the user stacks window, now backed by
+ * frames. Kernel mappings use global and 4M pages when supported */
+void setup_paging(void);
+
+/** Map one page. Returns -1 if a page table cannot be allocated */
+int paging_map(uint32_t *dir, void *virt, uint32_t phys, unsigned flags);
+/** Unmap one page. Returns its physical address or 0 */
+uint32_t paging_unmap(uint32_t *dir, void *virt);
+/** Get physical address of a mapped page and its flags. Returns 0 if not mapped */
+uint32_t paging_lookup(const uint32_t *dir, const void *virt, unsigned *flags);
+/** Entry of a present 4K page or NULL. Call paging_invalidate after a change */
+uint32_t *paging_pte(uint32_t *dir, const void *virt);
+/** Drop virt from the TLB if dir is loaded */
+void paging_invalidate(const uint32_t *dir, const void *virt);
+
+/** Back unmapped pages of [start, end) with new zeroed frames */
+int paging_map_range(uint32_t *dir, void *start, void *end, unsigned flags);
+/** Unmap pages in [start, end) and release their frames */
+void paging_unmap_range(uint32_t *dir, void *start, void *end);
+
+/** Whether virt is in a present user page */
+int paging_is_user(const uint32_t *dir, const void *virt);
+/** Whether virt is in a present user page that user code may write, maybe
+ * once copied */
+int paging_is_user_writable(const uint32_t *dir, const void *virt);
+
+#endif
@@ -1,6 +1,8 @@
 #include "queues.h"
 
 #include "mem.h"
+#include "slab.h"
+#include "stdbool.h"
 #include "stddef.h"
 #include "stdint.h"
 #include "stdio.h"
@@ -11,10 +13,47 @@ struct queue_t {
   int *messages;
   struct process_t *empty_process;
   struct process_t *full_process;
+  /** Created by pcreate_kernel */
+  bool kernel;
 };
 
 struct queue_t queues[NBQUEUE] = {0};
 
+/** Message arrays up to 1 << (QUEUE_CACHES - 1) ints come from slab caches */
+#define QUEUE_CACHES 9
+static struct slab_cache_t message_caches[QUEUE_CACHES];
+static const char *message_cache_names[QUEUE_CACHES] = {
+  "queue-msg-1", "queue-msg-2", "queue-msg-4", "queue-msg-8", "queue-msg-16",
+  "queue-msg-32", "queue-msg-64", "queue-msg-128", "queue-msg-256"
+};
+
+void setup_queues() {
+  for (int i = 0; i < QUEUE_CACHES; i++) {
+    slab_cache_init(&message_caches[i], message_cache_names[i],
+                    (1 << i) * sizeof(int), sizeof(int), NULL);
+  }
+}
+/** Cache index for capacity or -1 if too large */
+static int message_cache_index(int capacity) {
+  for (int i = 0; i < QUEUE_CACHES; i++) {
+    if (capacity <= (1 << i)) return i;
+  }
+  return -1;
+}
+static int *alloc_messages(int capacity) {
+  const int i = message_cache_index(capacity);
+  if (i < 0) return mem_alloc(capacity * sizeof(int));
+  return slab_alloc(&message_caches[i]);
+}
+static void free_messages(int *messages, int capacity) {
+  const int i = message_cache_index(capacity);
+  if (i < 0) {
+    mem_free(messages, capacity * sizeof(int));
+  } else {
+    slab_free(&message_caches[i], messages);
+  }
+}
+
 int is_queue_full(struct queue_t *queue) {
   return queue->size == queue->capacity;
 }
@@ -152,28 +191,35 @@ int pcount(int fid, int *count) {
   return 0;
 }
 
-int pcreate(int count) {
+/** Queue of count messages, reserved to the kernel if kernel */
+static int create(int count, bool kernel) {
   if (count <= 0 || count > 10000) return -3;
   for (int fid = 0; fid < NBQUEUE; fid++) {
     struct queue_t *const q = &queues[fid];
     if (!is_queue_free(q)) continue;
 
-    q->capacity = count;
-    q->messages = mem_alloc(count * sizeof(int));
+    q->messages = alloc_messages(count);
     if (q->messages == NULL) return -2;
+    q->capacity = count;
     q->rear = count - 1;
     q->front = 0;
     q->size = 0;
+    q->kernel = kernel;
     return fid;
   }
   return -1;
 }
+int pcreate(int count) { return create(count, false); }
+int pcreate_kernel(int count) { return create(count, true); }
+int queue_is_kernel(int fid) {
+  return fid >= 0 && fid < NBQUEUE && !is_queue_free(&queues[fid]) && queues[fid].kernel;
+}
 
 int pdelete(int fid) {
   VALID_FID(fid);
   struct queue_t *const q = &queues[fid];
+  free_messages(q->messages, q->capacity);
   q->capacity = 0;
-  mem_free(q->messages, q->capacity * sizeof(int));
   wakeup_all_processes(&q->empty_process);
   wakeup_all_processes(&q->full_process);
   fix_scheduler();
@@ -185,14 +231,17 @@ int preceive(int fid, int *message) {
   struct queue_t *const q = &queues[fid];
   if (is_queue_empty(q)) {
     int retval = 0;
+    // Sender may run in an other address space: receive on kernel stack
+    int received = 0;
     struct process_t *const ps = getproc();
     remove_runnable(ps);
     ps->state = PS_WAIT_QUEUE_EMPTY;
     ps->state_attr.wait_queue.fid = fid;
     ps->state_attr.wait_queue.retval = &retval;
-    ps->state_attr.wait_queue.message = message;
+    ps->state_attr.wait_queue.message = &received;
     push_waiting_process(&q->empty_process, ps);
     tick_scheduler();
+    if (retval == 0 && message != NULL) *message = received;
     return retval;
   } else {
     int val = pop_message(q);
@@ -243,6 +292,12 @@ int psend(int fid, int message) {
   }
 }
 
+int ptrysend(int fid, int message) {
+  VALID_FID(fid);
+  if (is_queue_full(&queues[fid])) return -2;
+  return psend(fid, message);
+}
+
 /** Get N firsts queues status. Returns total queues count */
 int queues_status(struct queue_status_t *status, int count) {
   if (count < 0) return -1;
@@ -4,6 +4,9 @@
 #include "scheduler.h"
 #include "system.h"
 
+/** Setup message caches. Must be called before pcreate */
+void setup_queues();
+
 /** Writes in "count" parameter : 
         - Number of messages in queue fid + number of bloqued processes on full queue
         - Opposite of the number of bloqued processes on empty queue (negative number)
@@ -15,6 +18,12 @@ int pcount(int fid, int *count);
         or a negative number if count negative or nul or no more available queue */
 int pcreate(int count);
 
+/** pcreate for kernel processes: messages may carry kernel data, so user
+    processes cannot use the queue, see queue_is_kernel */
+int pcreate_kernel(int count);
+/** Whether fid was created by pcreate_kernel */
+int queue_is_kernel(int fid);
+
 /** Destroys the fid queue
     Returns NULL or negative if invalid fid */
 int pdelete(int fid);
@@ -32,6 +41,9 @@ int preset(int fid);
     Returns NULL or negative if invalid fid */
 int psend(int fid, int message);
 
+/** psend that never blocks: returns -2 if queue fid is full */
+int ptrysend(int fid, int message);
+
 /** Update queue empty waiting list order after priority change */
 void queue_reorder_empty_process(struct process_t *process);
 /** Update queue full waiting list order after priority change */
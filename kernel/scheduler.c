@@ -5,13 +5,21 @@
 #include "string.h"
 #include "start.h"
 #include "user_stack_mem.h"
+#include "user_heap.h"
+#include "mm.h"
+#include "paging.h"
 #include "debug.h"
+#include "stdio.h"
 #include "interrupt.h"
 #include "queues.h"
+#include "ipc.h"
+#include "filesystem.h"
+#include "file_aio.h"
 
 struct process_t processes[NBPROC] = {0};
 /** Currently running process */
 struct process_t* active_process;
+int stack_watch = 0;
 
 /** Linked list of runnable processes sorted by descressing priority. Next is state_attr.next_runnable */
 struct process_t* runnable_process_head = NULL;
@@ -28,10 +36,47 @@ extern void PROC_end();
 void* const PROC_end_user = user_start + 0x25;
 /** Switch to usermode with iret */
 extern void JMP_usermode();
+/** Return to usermode from a system call frame */
+extern void FORK_ret();
+
+/** Kernel stack words of a system call from usermode: the iret frame then
+ * ebp, esi, edi, edx, ecx, ebx and eax pushed by IT_USR_handler */
+#define SYSCALL_FRAME 12
 
 /** Any process termination (kill, exit, return) */
 int stop(int pid, int retval);
 
+/** Kernel stacks are filled with it at creation to find their deepest use */
+#define STACK_PAINT 0x5ac4b175
+
+static void paint_kernel_stack(struct process_t* ps) {
+  for (int i = 0; i < NBSTACK; i++) ps->kernel_stack[i] = STACK_PAINT;
+}
+static unsigned long kernel_stack_used(const struct process_t* ps) {
+  int i = 0;
+  while (i < NBSTACK && ps->kernel_stack[i] == STACK_PAINT) i++;
+  return (NBSTACK - i) * sizeof(int32_t);
+}
+/** Measure stacks of a live process. Idle runs on the boot stack instead
+ * of its kernel_stack, and is left out */
+static void measure_stacks(struct process_t* ps) {
+  if (ps == &processes[0]) return;
+  ps->kstack_used = kernel_stack_used(ps);
+  ps->stack_used = ps->user_stack != NULL ?
+      user_stack_used(ps->mm, ps->user_stack, ps->ssize) : 0;
+}
+/** Report stacks within 10% of overflow */
+static void watch_stacks(const struct process_t* ps) {
+  if (ps->kstack_used * 10 >= NBSTACK * sizeof(int32_t) * 9) {
+    printf("%s (pid %d): kernel stack %lu of %lu bytes used\n", ps->name, ps->pid,
+           ps->kstack_used, (unsigned long)(NBSTACK * sizeof(int32_t)));
+  }
+  if (ps->user_stack != NULL && ps->stack_used * 10 >= ps->ssize * 9) {
+    printf("%s (pid %d): user stack %lu of %lu bytes used\n", ps->name, ps->pid,
+           ps->stack_used, ps->ssize);
+  }
+}
+
 /** Remove process from runnable list */
 void remove_runnable(struct process_t* ps) {
   if (runnable_process_head != NULL && ps->state == PS_RUNNABLE) {
@@ -116,6 +161,10 @@ int chprio(int pid, int newprio) {
     queue_reorder_full_process(ps);
     break;
 
+  case PS_IPC_SEND:
+    ipc_reorder_process(ps);
+    break;
+
   default:
     break;
   }
@@ -144,8 +193,12 @@ int start_background(int (*pt_func)(void*), unsigned long ssize, int prio,
   ps->prio = prio;
   ps->parent = getpid();
   ps->ssize = 0;
-  //NOTE: no user_stack for kernel process
+  //NOTE: no user_stack nor heap for kernel process
   ps->user_stack = NULL;
+  ps->heap_base = 0;
+  ps->heap_brk = 0;
+  ps->mm = NULL;
+  paint_kernel_stack(ps);
   ps->kernel_stack[NBSTACK - 3] = (int32_t)pt_func;
   ps->kernel_stack[NBSTACK - 2] = (int32_t)&PROC_end;
   ps->kernel_stack[NBSTACK - 1] = (int32_t)arg;
@@ -160,6 +213,13 @@ int start(int (*pt_func)(void*), unsigned long ssize, int prio,
   return pid;
 }
 
+/** Write on a user stack of mm, which may not be loaded */
+static void user_stack_poke(struct mm_t* mm, int32_t* addr, int32_t value) {
+  const uint32_t phys = paging_lookup(mm_dir(mm), addr, NULL);
+  assert(phys != 0);
+  *(int32_t*)((char*)P2V(phys) + ((uint32_t)addr & (PAGE_SIZE - 1))) = value;
+}
+
 int start_user_background(int (*pt_func)(void*), unsigned long ssize, int prio,
                      const char* name, void* arg) {
   if (ssize > MAXSTACK) return -2;
@@ -174,12 +234,32 @@ int start_user_background(int (*pt_func)(void*), unsigned long ssize, int prio,
   ps->parent = getpid();
   ps->ssize = ssize + 20 * sizeof(int32_t);
   ps->ssize += ps->ssize % sizeof(int32_t);
-  ps->user_stack = user_stack_alloc(ps->ssize);
-  if (ps->user_stack == NULL) return -1;
+  // Processes started by a user process share its address space
+  ps->mm = getproc()->mm;
+  if (ps->mm != NULL) {
+    mm_get(ps->mm);
+  } else {
+    ps->mm = mm_create();
+  }
+  ps->heap_brk = 0;
+  ps->user_stack = ps->mm != NULL ? user_stack_alloc(ps->mm, ps->ssize) : NULL;
+  if (ps->user_stack == NULL || user_heap_create(ps) < 0) {
+    if (ps->user_stack != NULL) {
+      user_stack_unmap(ps->mm, ps->user_stack, ps->ssize);
+      user_stack_free(ps->user_stack, ps->ssize);
+    }
+    mm_put(ps->mm);
+    ps->mm = NULL;
+    ps->user_stack = NULL;
+    ps->state_attr.next_dead = dead_process_head;
+    dead_process_head = ps;
+    return -1;
+  }
 
   const unsigned long user_stack_size = ps->ssize / sizeof(int32_t);
-  ps->user_stack[user_stack_size - 2] = (int32_t)PROC_end_user;
-  ps->user_stack[user_stack_size - 1] = (int32_t)arg;
+  user_stack_poke(ps->mm, &ps->user_stack[user_stack_size - 2], (int32_t)PROC_end_user);
+  user_stack_poke(ps->mm, &ps->user_stack[user_stack_size - 1], (int32_t)arg);
+  paint_kernel_stack(ps);
   ps->kernel_stack[NBSTACK - 6] = (int32_t)&JMP_usermode;
   ps->kernel_stack[NBSTACK - 5] = (int32_t)pt_func;
   ps->kernel_stack[NBSTACK - 4] = USER_CS;
@@ -197,15 +277,64 @@ int start_user(int (*pt_func)(void*), unsigned long ssize, int prio,
   return pid;
 }
 
+int fork(void) {
+  struct process_t* const parent = getproc();
+  if (parent->mm == NULL) return -1;
+  if (dead_process_head == NULL) return NOPID;
+
+  const int heap_slot = (parent->heap_base - USER_HEAP_BASE) / USER_HEAP_SLOT;
+  struct mm_t* const mm = mm_fork(parent->mm, parent->heap_brk != 0 ? heap_slot : -1);
+  if (mm == NULL) return -1;
+  struct process_t* const ps = dead_process_head;
+  dead_process_head = dead_process_head->state_attr.next_dead;
+  assert(ps->state == PS_DEAD);
+
+  ps->name = parent->name;
+  ps->prio = parent->prio;
+  ps->parent = parent->pid;
+  ps->ssize = parent->ssize;
+  ps->user_stack = parent->user_stack;
+  user_stack_share(ps->user_stack);
+  ps->heap_base = parent->heap_base;
+  ps->heap_brk = parent->heap_brk;
+  ps->mm = mm;
+  fs_fork_files(parent, ps);
+
+  // Child returns 0 from the same system call
+  paint_kernel_stack(ps);
+  int32_t* const frame = &ps->kernel_stack[NBSTACK - 1 - SYSCALL_FRAME];
+  memcpy(frame, &parent->kernel_stack[NBSTACK - 1 - SYSCALL_FRAME],
+         SYSCALL_FRAME * sizeof(int32_t));
+  frame[0] = 0;
+  frame[-1] = (int32_t)&FORK_ret;
+  ps->registers[1] = (int32_t)&frame[-1];
+  push_runnable(ps);
+  fix_scheduler();
+  return ps->pid;
+}
+
 void exit(int retval) {
   stop(getpid(), retval);
   while(1); //noreturn
 }
 int kill(int pid) {
   if (pid <= 0) return NOPID;
+  ALIVE_PID(pid)
+  struct process_t* const ps = &processes[pid];
+  if (ps->uninterruptible > 0) {
+    ps->kill_pending = true;
+    return 0;
+  }
   return stop(pid, 0);
 }
 
+void uninterruptible_enter(void) { getproc()->uninterruptible++; }
+void uninterruptible_leave(void) {
+  struct process_t* const ps = getproc();
+  assert(ps->uninterruptible > 0);
+  if (--ps->uninterruptible == 0 && ps->kill_pending) exit(0);
+}
+
 void wait_clock(unsigned long clock)
 {
   const int pid = getpid();
@@ -331,6 +460,19 @@ int stop(int pid, int retval) {
   default:
     break;
   }
+  ipc_remove_process(ps);
+  // Left held when exiting on a fault inside a filesystem call
+  fs_release_lock(ps);
+  ps->uninterruptible = 0;
+  ps->kill_pending = false;
+  measure_stacks(ps);
+  if (stack_watch) watch_stacks(ps);
+  file_aio_cancel(ps);
+  fs_close_files(ps);
+  user_heap_destroy(ps);
+  if (ps->user_stack != NULL) user_stack_unmap(ps->mm, ps->user_stack, ps->ssize);
+  mm_put(ps->mm);
+  ps->mm = NULL;
 
   remove_runnable(ps);
   if (ps->parent == NOPID) {
@@ -350,11 +492,33 @@ int stop(int pid, int retval) {
   return retval;
 }
 
+/** Switch from prev_process to active_process */
+static void resume_active(struct process_t* prev_process) {
+  // Save current process stack top address
+  tss.esp0 = (int32_t)&active_process->kernel_stack[NBSTACK-1];
+  mm_switch(active_process->mm);
+  user_info->pid = active_process->pid;
+  user_info->heap = active_process->heap_base;
+  CTX_switch(prev_process->registers, active_process->registers);
+}
+
 void fix_scheduler() {
   if (active_process->state != PS_RUNNING ||
   (runnable_process_head != NULL && active_process->prio < runnable_process_head->prio))
     tick_scheduler();
 }
+void handoff(struct process_t* ps) {
+  assert(active_process->state != PS_RUNNING && ps->state != PS_RUNNABLE);
+  if (runnable_process_head != NULL && runnable_process_head->prio > ps->prio) {
+    push_runnable(ps);
+    tick_scheduler();
+    return;
+  }
+  struct process_t* prev_process = active_process;
+  active_process = ps;
+  active_process->state = PS_RUNNING;
+  resume_active(prev_process);
+}
 /** Change running process */
 void tick_scheduler() {
   {  // Wake up processes on PS_ASLEEP
@@ -378,9 +542,7 @@ void tick_scheduler() {
       push_runnable(prev_process);
     }
     active_process->state = PS_RUNNING;
-    // Save current process stack top address
-    tss.esp0 = (int32_t)&active_process->kernel_stack[NBSTACK-1];
-    CTX_switch(prev_process->registers, active_process->registers);
+    resume_active(prev_process);
   }
 }
 
@@ -400,6 +562,10 @@ int processes_status(struct process_status_t *status, int count) {
       status[alive].prio = ps->prio;
       status[alive].state = ps->state;
       status[alive].ssize = ps->ssize;
+      // Zombies were measured on stop
+      if (ps->state != PS_ZOMBIE) measure_stacks(ps);
+      status[alive].stack_used = ps->stack_used;
+      status[alive].kstack_used = ps->kstack_used;
     }
     alive++;
   }
@@ -1,6 +1,7 @@
 #ifndef SCHEDULER_H_
 #define SCHEDULER_H_
 
+#include "stdbool.h"
 #include "stdint.h"
 #include "system.h"
 
@@ -12,6 +13,9 @@
 #define MINPRIO 1
 #define MAXPRIO 256
 
+struct mm_t;
+struct open_file_t;
+
 struct process_t
 {
   int pid;
@@ -44,9 +48,21 @@ struct process_t
       /** Message to send or receive */
       int* message;
     } wait_queue;
+    struct {
+      /** Next process calling the same server */
+      struct process_t* next;
+      /** Server pid (when calling) or NOPID (when receiving) */
+      int peer;
+      /** Message buffer on waiting process kernel stack */
+      struct ipc_msg_t* message;
+      /** Return value after waiting */
+      int* retval;
+    } ipc;
     /** Next dead process (free pid) */
     struct process_t* next_dead;
   } state_attr;
+  /** Processes blocked in call on this one, sorted by priority */
+  struct process_t* ipc_senders;
   int32_t registers[5];
   /** Kernel-space (Ring0) stack */
   int32_t kernel_stack[NBSTACK];
@@ -54,8 +70,27 @@ struct process_t
   int32_t* user_stack;
   /** user_stack size in bytes */
   unsigned long ssize;
+  /** Heap slot and its end, or 0 without heap */
+  uint32_t heap_base;
+  uint32_t heap_brk;
+  /** Address space or NULL for kernel process */
+  struct mm_t* mm;
+  /** Open files by descriptor, shared with forked processes */
+  struct open_file_t* files[NBFILES];
+  /** Depth of sections kill() waits for, see uninterruptible_enter */
+  int uninterruptible;
+  /** Killed inside such a section: exits once out of it */
+  bool kill_pending;
+  /** Deepest user and kernel stacks use in bytes, measured on stop */
+  unsigned long stack_used;
+  unsigned long kstack_used;
 };
 
+/** Process table indexed by pid */
+extern struct process_t processes[NBPROC];
+/** Log processes which used more than 90% of a stack when they stop */
+extern int stack_watch;
+
 /** Initialize process table */
 void setup_scheduler();
 /** Lowest priority halt process */
@@ -85,14 +120,28 @@ int start_user(int (*pt_func)(void *), unsigned long ssize, int prio,
 int start_user_background(int (*pt_func)(void *), unsigned long ssize, int prio,
           const char *name, void *arg);
 
+/** Copy active user process with a copy-on-write address space. Returns
+ * child pid to the parent and 0 to the child */
+int fork(void);
+
 void exit(int retval);
+/** Stop pid, once out of its uninterruptible sections */
 int kill(int pid);
+/** Start a section changing state shared by processes, such as the
+ * filesystem or a disk queue, which kill() must not leave half done.
+ * Sections nest */
+void uninterruptible_enter(void);
+/** End the section, exiting if killed inside the outermost one */
+void uninterruptible_leave(void);
 
 void wait_clock(unsigned long clock);
 int waitpid(int pid, int *retvalp);
 
 void remove_runnable(struct process_t* ps);
 void push_runnable(struct process_t* ps);
+/** Give CPU to ps without going through runnable list if no runnable process
+ * has a higher priority. Active process must not be PS_RUNNING */
+void handoff(struct process_t* ps);
 
 /** Get N firsts processes status. Returns total processes count */
 int processes_status(struct process_status_t *status, int count);
@@ -31,6 +31,14 @@ void write_com1(int c)
 	outb(c, 0x3f8);
 }
 
+void serial_puts(const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '\n') write_com1('\r');
+		write_com1(*s);
+	}
+}
+
 int read_com1(void)
 {
 	int c;
@@ -3,5 +3,7 @@
 
 void write_com1(int c);
 int read_com1(void);
+/** Write a string, with CR before each LF */
+void serial_puts(const char *s);
 
 #endif /*SERIAL_H_*/
@@ -0,0 +1,189 @@
+#include "slab.h"
+
+#include "mem.h"
+#include "stdio.h"
+#include "string.h"
+
+/** Smallest slab size. Slabs are aligned on their size so the header of an
+ * object slab is found by masking its address */
+#define SLAB_MIN_SIZE 4096
+/** Slab size grows until this number of objects fits */
+#define SLAB_MIN_OBJECTS 8
+/** Coloring step: one cache line */
+#define SLAB_COLOR_ALIGN 32
+/** End of slab free list */
+#define SLAB_END 0xffff
+
+struct slab_t {
+  struct slab_cache_t *cache;
+  /** Next slab in cache list */
+  struct slab_t *next;
+  /** Previous next pointer in cache list */
+  struct slab_t **pprev;
+  /** First object (after header and color) */
+  char *objects;
+  unsigned inuse;
+  /** Index of first free object or SLAB_END */
+  uint16_t free;
+  /** Index of next free object for each free object. Kept outside of
+   * objects to preserve their constructed state */
+  uint16_t next_free[];
+};
+
+/** Linked list of registered caches */
+struct slab_cache_t *slab_caches = NULL;
+
+static size_t align_up(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+static size_t header_size(struct slab_cache_t *cache, unsigned per_slab) {
+  return align_up(sizeof(struct slab_t) + per_slab * sizeof(uint16_t), cache->align);
+}
+
+static void slab_push(struct slab_t **head, struct slab_t *slab) {
+  slab->next = *head;
+  if (*head != NULL) (*head)->pprev = &slab->next;
+  slab->pprev = head;
+  *head = slab;
+}
+static void slab_remove(struct slab_t *slab) {
+  *slab->pprev = slab->next;
+  if (slab->next != NULL) slab->next->pprev = slab->pprev;
+}
+
+void slab_cache_init(struct slab_cache_t *cache, const char *name, size_t size,
+                     size_t align, void (*ctor)(void *)) {
+  assert(size > 0 && size <= SLAB_MAX_OBJECT);
+  if (align < sizeof(void *)) align = sizeof(void *);
+  assert((align & (align - 1)) == 0);
+
+  memset(cache, 0, sizeof(*cache));
+  cache->name = name;
+  cache->align = align;
+  cache->size = align_up(size, align);
+  cache->ctor = ctor;
+
+  cache->slab_size = SLAB_MIN_SIZE;
+  unsigned per_slab;
+  while (1) {
+    per_slab = (cache->slab_size - sizeof(struct slab_t)) /
+               (cache->size + sizeof(uint16_t));
+    while (per_slab > 0 &&
+           header_size(cache, per_slab) + per_slab * cache->size > cache->slab_size) {
+      per_slab--;
+    }
+    if (per_slab >= SLAB_MIN_OBJECTS) break;
+    cache->slab_size *= 2;
+  }
+  if (per_slab >= SLAB_END) per_slab = SLAB_END - 1;
+  cache->per_slab = per_slab;
+
+  const size_t left = cache->slab_size - header_size(cache, per_slab) - per_slab * cache->size;
+  const size_t step = align > SLAB_COLOR_ALIGN ? align : SLAB_COLOR_ALIGN;
+  cache->color_max = left - left % step;
+
+  cache->next = slab_caches;
+  slab_caches = cache;
+}
+
+/** Get a new slab with constructed objects */
+static struct slab_t *slab_create(struct slab_cache_t *cache) {
+  struct slab_t *const slab = mem_alloc_aligned(cache->slab_size, cache->slab_size);
+  if (slab == NULL) return NULL;
+
+  slab->cache = cache;
+  slab->inuse = 0;
+  slab->objects = (char *)slab + header_size(cache, cache->per_slab) + cache->color_next;
+  // Shift objects of next slab to use other cache lines
+  const size_t step = cache->align > SLAB_COLOR_ALIGN ? cache->align : SLAB_COLOR_ALIGN;
+  cache->color_next += step;
+  if (cache->color_next > cache->color_max) cache->color_next = 0;
+
+  for (unsigned i = 0; i < cache->per_slab; i++) {
+    slab->next_free[i] = i + 1 < cache->per_slab ? i + 1 : SLAB_END;
+    if (cache->ctor) cache->ctor(slab->objects + i * cache->size);
+  }
+  slab->free = 0;
+  cache->slabs++;
+  return slab;
+}
+static void slab_destroy(struct slab_t *slab) {
+  assert(slab->inuse == 0);
+  slab->cache->slabs--;
+  mem_free_aligned(slab);
+}
+
+void *slab_alloc(struct slab_cache_t *cache) {
+  struct slab_t *slab = cache->partial;
+  if (slab == NULL) {
+    slab = cache->empty;
+    cache->empty = NULL;
+    if (slab == NULL) slab = slab_create(cache);
+    if (slab == NULL) return NULL;
+    slab_push(&cache->partial, slab);
+  }
+
+  const unsigned i = slab->free;
+  slab->free = slab->next_free[i];
+  slab->inuse++;
+  if (slab->free == SLAB_END) {
+    slab_remove(slab);
+    slab_push(&cache->full, slab);
+  }
+  cache->allocs++;
+  cache->active++;
+  return slab->objects + i * cache->size;
+}
+
+void slab_free(struct slab_cache_t *cache, void *obj) {
+  struct slab_t *const slab = (struct slab_t *)((uint32_t)obj & ~(cache->slab_size - 1));
+  assert(slab->cache == cache);
+  const unsigned i = ((char *)obj - slab->objects) / cache->size;
+  assert(i < cache->per_slab && slab->objects + i * cache->size == obj);
+
+  if (slab->free == SLAB_END) {
+    slab_remove(slab);
+    slab_push(&cache->partial, slab);
+  }
+  slab->next_free[i] = slab->free;
+  slab->free = i;
+  slab->inuse--;
+  cache->frees++;
+  cache->active--;
+
+  if (slab->inuse == 0) {
+    slab_remove(slab);
+    if (cache->empty == NULL) {
+      cache->empty = slab;
+    } else {
+      slab_destroy(slab);
+    }
+  }
+}
+
+void slab_cache_shrink(struct slab_cache_t *cache) {
+  if (cache->empty != NULL) {
+    slab_destroy(cache->empty);
+    cache->empty = NULL;
+  }
+}
+
+int slabs_status(struct slab_status_t *status, int count) {
+  if (count < 0) return -1;
+
+  int n = 0;
+  for (struct slab_cache_t *c = slab_caches; c != NULL; c = c->next) {
+    if (n < count) {
+      strncpy(status[n].name, c->name, 19);
+      status[n].name[19] = '\0';
+      status[n].size = c->size;
+      status[n].active = c->active;
+      status[n].total = c->slabs * c->per_slab;
+      status[n].slabs = c->slabs;
+      status[n].allocs = c->allocs;
+      status[n].frees = c->frees;
+    }
+    n++;
+  }
+  return n;
+}
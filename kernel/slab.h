@@ -0,0 +1,55 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include "stddef.h"
+#include "stdint.h"
+#include "system.h"
+
+struct slab_t;
+
+/** Object cache for fixed size kernel objects */
+struct slab_cache_t {
+  const char *name;
+  /** Object size in bytes, rounded to alignment */
+  size_t size;
+  size_t align;
+  /** Bytes per slab, power of 2 and slab alignment */
+  size_t slab_size;
+  /** Objects per slab */
+  unsigned per_slab;
+  /** Offset of first object in next slab (coloring) */
+  unsigned color_next;
+  /** Max color offset */
+  unsigned color_max;
+  /** Called once per object when its slab is created, not on each alloc.
+   * Objects must be freed back in constructed state */
+  void (*ctor)(void *obj);
+  /** Slabs with free objects */
+  struct slab_t *partial;
+  /** Slabs without free objects */
+  struct slab_t *full;
+  /** Unused slab kept to avoid alloc/free ping-pong */
+  struct slab_t *empty;
+  /** Statistics */
+  unsigned long allocs, frees, active, slabs;
+  /** Next registered cache */
+  struct slab_cache_t *next;
+};
+
+/** Setup and register cache. size must be lower than SLAB_MAX_OBJECT */
+void slab_cache_init(struct slab_cache_t *cache, const char *name, size_t size,
+                     size_t align, void (*ctor)(void *));
+/** Release every unused slab of cache */
+void slab_cache_shrink(struct slab_cache_t *cache);
+
+/** Get constructed object or NULL if out of memory */
+void *slab_alloc(struct slab_cache_t *cache);
+/** Give back object obtained from slab_alloc on the same cache */
+void slab_free(struct slab_cache_t *cache, void *obj);
+
+/** Get N firsts caches status. Returns total caches count */
+int slabs_status(struct slab_status_t *status, int count);
+
+#define SLAB_MAX_OBJECT 2048
+
+#endif /*SLAB_H_*/
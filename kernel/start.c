@@ -5,8 +5,15 @@
 #include "cpu.h"
 #include "scheduler.h"
 #include "filesystem.h"
+#include "file_aio.h"
 #include "test.h"
 #include "start.h"
+#include "queues.h"
+#include "frame_mem.h"
+#include "mm.h"
+#include "paging.h"
+#include "user_heap.h"
+#include "user_stack_mem.h"
 
 int proc_wait(void* arg) {
   const unsigned long seconds = (unsigned long)arg;
@@ -24,10 +31,19 @@ void kernel_start(void)
   // Splash screen
   printf(CALMOS_LOGO);
 
+  setup_frame_mem();
+  setup_paging();
+  setup_user_stacks();
+  setup_mm();
   setup_scheduler();
+  setup_user_heap();
+  setup_queues();
   setup_interrupt_handlers();
   setup_filesystem();
+  setup_file_aio();
 
+  // NOTE: Log processes ending within 10% of a stack overflow
+  // stack_watch = 1;
   // NOTE: Kernel tests
   // test_all();
   start_user_background(user_start, 4000, 1, "user_start", NULL);
@@ -4,30 +4,88 @@
 #include "scheduler.h"
 #include "interrupt.h"
 #include "queues.h"
+#include "ipc.h"
+#include "mem.h"
+#include "slab.h"
+#include "mm.h"
+#include "paging.h"
+#include "user_heap.h"
+#include "user_stack_mem.h"
 #include "keyboard.h"
 #include "beep.h"
 #include "syscall.h"
 #include "boot/processor_structs.h"
 #include "filesystem.h"
+#include "file_map.h"
+#include "file_aio.h"
 #include "debug.h"
+#include "string.h"
 
-#define IS_USER_PTR(p) (p >= (void*)user_start && p < (void*)user_end)
+#define IS_USER_PTR(p) \
+(paging_is_user(mm_dir(getproc()->mm), p) || user_stack_fault(getproc()->mm, p) == 0 || \
+ file_map_fault(getproc()->mm, p) == 0)
 //FIXME: process must segfault
 #define SEGFAULT() return -42;
 #define USER_PTR(p) \
 if (!IS_USER_PTR(p)) SEGFAULT();
-#define USER_OR_NULL_PTR(p) \
-if (p != NULL) { USER_PTR(p); }
+/** Buffers the kernel reads, resp. writes: every page must allow it */
+#define USER_IN(p, n) \
+if (!user_range(p, (size_t)(n), 0)) SEGFAULT();
+#define USER_OUT(p, n) \
+if (!user_range(p, (size_t)(n), 1)) SEGFAULT();
+#define USER_IN_OR_NULL(p, n) \
+if (p != NULL) { USER_IN(p, n); }
+#define USER_OUT_OR_NULL(p, n) \
+if (p != NULL) { USER_OUT(p, n); }
+/** Array of count elements of type the kernel writes */
+#define USER_OUT_ARRAY(p, count, type) \
+if ((size_t)(count) > (size_t)-1 / sizeof(type)) SEGFAULT(); \
+USER_OUT(p, (size_t)(count) * sizeof(type));
+#define USER_STRING(p) \
+if (!user_string((const char*)(p))) SEGFAULT();
+/** Fill mapped file pages of a buffer the kernel reads holding the
+ * filesystem lock, as filling them takes it */
+#define USER_MAPPED(p, n) \
+if (file_map_prefault(getproc()->mm, p, (uint32_t)(n)) < 0) SEGFAULT();
+/** USER_MAPPED on a path the kernel reads holding the filesystem lock */
+#define USER_MAPPED_STRING(p) \
+USER_MAPPED(p, strlen((const char*)(p)) + 1);
+/** Kernel queues carry kernel data: seen as invalid by user processes */
+#define USER_FID(fid) \
+if (queue_is_kernel((int)(fid))) return -1;
+
+/** Whether [p, p + n) is in user pages, writable if write. A kernel
+ * access to another page faults in kernel mode */
+static int user_range(const void *p, size_t n, int write) {
+  if (n == 0) return 1;
+  const uint32_t last = (uint32_t)p + n - 1;
+  if (last < (uint32_t)p) return 0;
+  for (uint32_t page = (uint32_t)p & ~(PAGE_SIZE - 1);; page += PAGE_SIZE) {
+    if (!IS_USER_PTR((void*)page)) return 0;
+    if (write && !paging_is_user_writable(mm_dir(getproc()->mm), (void*)page)) return 0;
+    if (page == (last & ~(PAGE_SIZE - 1))) return 1;
+  }
+}
+/** Whether a string ending in user pages starts at p */
+static int user_string(const char *p) {
+  for (;;) {
+    if (!IS_USER_PTR((void*)p)) return 0;
+    const char *const end = (const char*)(((uint32_t)p & ~(PAGE_SIZE - 1)) + PAGE_SIZE);
+    while (p < end) {
+      if (*p++ == '\0') return 1;
+    }
+  }
+}
 
 int user_IT(int call_id, void* p1, void* p2, void* p3, void* p4, void* p5) {
   switch (call_id) {
     case 0:
-      USER_PTR(p1);
+      USER_IN(p1, p2);
       console_putbytes((const char*)p1, (int)p2);
       return 0;
 
     case 10:
-      USER_PTR(p1);
+      USER_IN(p1, p2);
       return cons_write((const char*)p1, (long)p2);
     case 11:
       return cons_read();
@@ -35,7 +93,7 @@ int user_IT(int call_id, void* p1, void* p2, void* p3, void* p4, void* p5) {
       cons_echo((int)p1);
       return 0;
     case 13:
-      USER_PTR(p1);
+      USER_OUT(p1, p2);
       return cons_readline((char*)p1, (unsigned long)p2);
     case 14:
       beep((int)p1, *(float*)&p2);
@@ -44,10 +102,10 @@ int user_IT(int call_id, void* p1, void* p2, void* p3, void* p4, void* p5) {
     case 20:
       return getpid();
     case 21:
-      USER_OR_NULL_PTR(p2);
+      USER_OUT_OR_NULL(p2, sizeof(int));
       return waitpid((int)p1, (int*)p2);
     case 22:
-      USER_PTR(p1);
+      USER_OUT_ARRAY(p1, p2, struct process_status_t);
       return processes_status((struct process_status_t*)p1, (int)p2);
 
     case 30:
@@ -56,26 +114,47 @@ int user_IT(int call_id, void* p1, void* p2, void* p3, void* p4, void* p5) {
       return getprio((int)p1);
 
     case 40:
-      USER_OR_NULL_PTR(p2);
+      USER_FID(p1);
+      USER_OUT_OR_NULL(p2, sizeof(int));
       return pcount((int)p1, (int*)p2);
     case 41:
       return pcreate((int)p1);
     case 42:
+      USER_FID(p1);
       return pdelete((int)p1);
     case 43:
-      USER_OR_NULL_PTR(p2);
+      USER_FID(p1);
+      USER_OUT_OR_NULL(p2, sizeof(int));
       return preceive((int)p1, (int*)p2);
     case 44:
+      USER_FID(p1);
       return preset((int)p1);
     case 45:
+      USER_FID(p1);
       return psend((int)p1, (int)p2);
     case 46:
-      USER_PTR(p1);
+      USER_OUT_ARRAY(p1, p2, struct queue_status_t);
       return queues_status((struct queue_status_t*)p1, (int)p2);
+    case 47: {
+      USER_IN(p2, sizeof(struct ipc_msg_t));
+      USER_OUT_OR_NULL(p3, sizeof(struct ipc_msg_t));
+      struct ipc_msg_t reply;
+      const int ret = ipc_call((int)p1, (const struct ipc_msg_t*)p2, &reply);
+      if (ret == 0 && p3 != NULL) *(struct ipc_msg_t*)p3 = reply;
+      return ret;
+    }
+    case 48: {
+      USER_IN_OR_NULL(p2, sizeof(struct ipc_msg_t));
+      USER_OUT_OR_NULL(p3, sizeof(struct ipc_msg_t));
+      struct ipc_msg_t msg;
+      const int ret = ipc_reply_wait((int)p1, (const struct ipc_msg_t*)p2, &msg);
+      if (ret >= 0 && p3 != NULL) *(struct ipc_msg_t*)p3 = msg;
+      return ret;
+    }
 
     case 50:
-      USER_OR_NULL_PTR(p1);
-      USER_OR_NULL_PTR(p2);
+      USER_OUT_OR_NULL(p1, sizeof(unsigned long));
+      USER_OUT_OR_NULL(p2, sizeof(unsigned long));
       clock_settings((unsigned long*)p1, (unsigned long*)p2);
       return 0;
     case 51:
@@ -86,7 +165,7 @@ int user_IT(int call_id, void* p1, void* p2, void* p3, void* p4, void* p5) {
 
     case 60:
       USER_PTR(p1);
-      USER_PTR(p4);
+      USER_STRING(p4);
       return start_user((int (*)(void*))p1, (unsigned long)p2, (int)p3, (const char*)p4, p5);
     case 61:
       return kill((int)p1);
@@ -98,26 +177,137 @@ int user_IT(int call_id, void* p1, void* p2, void* p3, void* p4, void* p5) {
       return -1;
 
     case 70:
-      USER_PTR(p1);
+      USER_OUT(p1, sizeof(DIR));
       *(DIR*)p1 = fs_root();
       return 0;
     case 71:
-      USER_PTR(p1);
-      USER_PTR(p2);
+      USER_IN(p1, sizeof(DIR));
+      USER_OUT_ARRAY(p2, p3, FILE);
+      USER_MAPPED(p2, (size_t)p3 * sizeof(FILE));
       return fs_list(*(DIR*)p1, (FILE *)p2, (size_t)p3, (size_t)p4);
     case 72:
-      USER_PTR(p1);
-      USER_PTR(p2);
-      fs_file_name((const FILE*)p1, (char*)p2, (size_t)p2);
+      USER_IN(p1, sizeof(FILE));
+      USER_OUT(p2, (size_t)p3 + 1);
+      USER_MAPPED(p1, sizeof(FILE));
+      USER_MAPPED(p2, (size_t)p3 + 1);
+      fs_file_name((const FILE*)p1, (char*)p2, (size_t)p3);
       return 0;
     case 73:
-      USER_PTR(p1);
-      USER_PTR(p2);
+      USER_OUT(p1, p4);
+      USER_IN(p2, sizeof(FILE));
+      USER_MAPPED(p1, p4);
+      USER_MAPPED(p2, sizeof(FILE));
       return fs_read(p1, (const FILE*)p2, (size_t)p3, (size_t)p4);
     case 74:
-      USER_PTR(p1);
-      USER_PTR(p3);
+      USER_IN(p1, sizeof(FILE));
+      USER_IN(p3, p4);
+      USER_MAPPED(p1, sizeof(FILE));
+      USER_MAPPED(p3, p4);
       return fs_write((const FILE*)p1, (size_t)p2, p3, (size_t)p4);
+    case 75:
+      fs_sync();
+      return 0;
+    case 76:
+      USER_OUT(p1, sizeof(struct disk_cache_status_t));
+      fs_cache_status((struct disk_cache_status_t*)p1);
+      return 0;
+    case 77:
+      USER_IN(p1, sizeof(DIR));
+      USER_STRING(p2);
+      USER_OUT(p3, sizeof(FILE));
+      USER_MAPPED_STRING(p2);
+      USER_MAPPED(p3, sizeof(FILE));
+      return fs_lookup(*(DIR*)p1, (const char*)p2, (FILE*)p3);
+    case 78:
+      USER_IN(p1, sizeof(DIR));
+      USER_OUT(p2, sizeof(DIR_CURSOR));
+      fs_opendir(*(DIR*)p1, (DIR_CURSOR*)p2);
+      return 0;
+    case 79:
+      USER_OUT(p1, sizeof(DIR_CURSOR));
+      USER_OUT_ARRAY(p2, p3, FILE);
+      USER_MAPPED(p1, sizeof(DIR_CURSOR));
+      USER_MAPPED(p2, (size_t)p3 * sizeof(FILE));
+      return fs_readdir((DIR_CURSOR*)p1, (FILE*)p2, (size_t)p3);
+    case 80:
+      USER_IN(p1, sizeof(DIR));
+      USER_STRING(p2);
+      USER_OUT(p3, sizeof(FILE));
+      USER_MAPPED_STRING(p2);
+      USER_MAPPED(p3, sizeof(FILE));
+      return fs_create(*(DIR*)p1, (const char*)p2, (FILE*)p3);
+    case 81:
+      USER_IN(p1, sizeof(FILE));
+      USER_MAPPED(p1, sizeof(FILE));
+      return fs_truncate((const FILE*)p1, (size_t)p2);
+    case 82:
+      USER_IN(p1, sizeof(FILE));
+      USER_MAPPED(p1, sizeof(FILE));
+      return fs_unlink((const FILE*)p1);
+    case 83:
+      USER_IN(p1, sizeof(FILE));
+      return (int)file_map((const FILE*)p1, (uint32_t)p2, (uint32_t)p3);
+    case 84:
+      return file_unmap(p1);
+    case 85:
+      USER_IN(p1, sizeof(DIR));
+      USER_STRING(p2);
+      USER_MAPPED_STRING(p2);
+      return fs_open(*(DIR*)p1, (const char*)p2, (int)p3);
+    case 86:
+      return fs_close((int)p1);
+    case 87:
+      USER_OUT(p2, p3);
+      USER_MAPPED(p2, p3);
+      return fs_fread((int)p1, p2, (size_t)p3);
+    case 88:
+      USER_IN(p2, p3);
+      USER_MAPPED(p2, p3);
+      return fs_fwrite((int)p1, p2, (size_t)p3);
+    case 89:
+      return fs_lseek((int)p1, (long)p2, (int)p3);
+
+    case 90:
+      USER_OUT_ARRAY(p1, p2, struct slab_status_t);
+      return slabs_status((struct slab_status_t*)p1, (int)p2);
+    case 91:
+      return (int)user_heap_sbrk((long)p1);
+    case 92:
+      USER_OUT_ARRAY(p1, p2, struct slab_status_t);
+      return user_stacks_status((struct slab_status_t*)p1, (int)p2);
+    case 93:
+      return fork();
+    case 94:
+      USER_OUT(p1, sizeof(struct meminfo_t));
+      meminfo((struct meminfo_t*)p1);
+      return 0;
+    case 95:
+      USER_OUT_ARRAY(p1, p2, struct heap_site_t);
+      return mem_heap_sites((struct heap_site_t*)p1, (int)p2, (int)p3);
+    case 96:
+      return mem_leak_report();
+
+    case 100:
+      USER_OUT(p2, p4);
+      return file_aio_submit((int)p1, p2, (size_t)p3, (size_t)p4, (int)p5, false);
+    case 101:
+      USER_IN(p2, p4);
+      return file_aio_submit((int)p1, p2, (size_t)p3, (size_t)p4, (int)p5, true);
+    case 102:
+      USER_OUT_ARRAY(p1, p2, struct file_completion_t);
+      return file_aio_poll((struct file_completion_t*)p1, (int)p2);
+    case 103:
+      return fs_sendfile((int)p1, (size_t)p2);
+    case 104:
+      USER_OUT(p1, sizeof(struct volume_frag_t));
+      USER_OUT_ARRAY(p2, p3, struct file_frag_t);
+      USER_MAPPED(p1, sizeof(struct volume_frag_t));
+      USER_MAPPED(p2, (size_t)p3 * sizeof(struct file_frag_t));
+      return fs_frag_report((struct volume_frag_t*)p1, (struct file_frag_t*)p2, (size_t)p3);
+    case 105:
+      USER_OUT(p1, sizeof(struct volume_frag_t));
+      USER_MAPPED(p1, sizeof(struct volume_frag_t));
+      return fs_defrag((struct volume_frag_t*)p1);
 
     default:
       SEGFAULT();
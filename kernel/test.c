@@ -3,6 +3,7 @@
 #include "stdio.h"
 #include "queues.h"
 #include "string.h"
+#include "filesystem.h"
 
 // Extracted from user/test.c
 
@@ -1675,6 +1676,86 @@ static void test20(void) {
   }
 }
 
+/*******************************************************************************
+ * Test 21
+ *
+ * fork() : le fils voit la memoire du pere au moment du fork, puis chacun
+ * garde ses propres ecritures (copie sur ecriture)
+ ******************************************************************************/
+static void test21(void) {
+  // fork copies a user address space, which kernel processes do not have
+  printf("This test can not work at kernel level.\n");
+}
+
+/*******************************************************************************
+ * Test 22
+ *
+ * Fichier cree, agrandi, tronque puis supprime : le contenu relu est celui
+ * ecrit, l'entree effacee ne designe plus aucun fichier et ses clusters
+ * sont rendus
+ ******************************************************************************/
+static void test22(void) {
+  static char data[3000], back[3000];
+  const DIR root = fs_root();
+  FILE f, g;
+  struct volume_frag_t before, after;
+  int i;
+
+  for (i = 0; i < 3000; i++) data[i] = 'a' + i % 26;
+  /* Reste d'un test interrompu */
+  if (fs_lookup(root, "/TEST22.TXT", &f) == 0) assert(fs_unlink(&f) == 0);
+  /* Clusters libres une fois les reservations rendues par fs_sync */
+  fs_sync();
+  fs_frag_report(&before, NULL, 0);
+  assert(fs_create(root, "TEST22.TXT", &f) == 0);
+  assert(fs_create(root, "TEST22.TXT", &g) == -3);
+  /* Pas de nom long : le nom serait coupe */
+  assert(fs_create(root, "TEST22LONG.TXT", &g) == -1);
+  assert(fs_create(root, "TEST22.TEXT", &g) == -1);
+  assert(fs_write(&f, 0, data, 1000) == 1000);
+  assert(fs_write(&f, 1000, data + 1000, 2000) == 2000);
+  assert(fs_lookup(root, "/test22.txt", &g) == 0);
+  assert(g.size == 3000);
+  fs_sync();
+  assert(fs_frag_report(&after, NULL, 0) == (int)before.files + 1);
+  assert(after.freeClusters < before.freeClusters);
+  printf("1");
+
+  assert(fs_read(back, &g, 0, 3000) == 3000);
+  for (i = 0; i < 3000; i++) assert(back[i] == data[i]);
+  printf(" 2");
+
+  assert(fs_truncate(&g, 1500) == 0);
+  assert(fs_truncate(&g, 2000) == -1);
+  assert(fs_lookup(root, "/TEST22.TXT", &g) == 0);
+  assert(g.size == 1500);
+  assert(fs_read(back, &g, 1000, 3000) == 500);
+  for (i = 0; i < 500; i++) assert(back[i] == data[1000 + i]);
+  printf(" 3");
+
+  assert(fs_unlink(&g) == 0);
+  assert(fs_lookup(root, "/TEST22.TXT", &f) == -1);
+  assert(fs_read(back, &g, 0, 1) == -1);
+  assert(fs_write(&g, 0, data, 1) == -1);
+  assert(fs_unlink(&g) == -1);
+  fs_sync();
+  fs_frag_report(&after, NULL, 0);
+  assert(after.freeClusters == before.freeClusters);
+  printf(" 4.\n");
+}
+
+/*******************************************************************************
+ * Test 23
+ *
+ * Lectures asynchrones : les fins arrivent sur la file dans l'ordre ou
+ * fs_async_poll les rend, et les requetes d'un processus termine sont
+ * abandonnees sans garder de place
+ ******************************************************************************/
+static void test23(void) {
+  // Requests read to and from a user address space, and the test forks
+  printf("This test can not work at kernel level.\n");
+}
+
 /* End */
 static void quit(void) { exit(0); }
 
@@ -1703,6 +1784,9 @@ static struct {
   // {"19", test19},
 	{"20", test20},
   {"7", test7},
+  {"21", test21},
+  {"22", test22},
+  {"23", test23},
 	{"q", quit},
 	{"quit", quit},
 	{"exit", quit},
@@ -1712,7 +1796,7 @@ static struct {
 int test_proc(void* arg) {
   const int n = (int)arg;
   assert(getprio(getpid()) == 128);
-  if ((n < 1) || (n > 20)) {
+  if ((n < 1) || (n > 23)) {
     printf("%d: unknown test\n", n);
   } else {
     commands[n - 1].f();
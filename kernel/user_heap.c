@@ -0,0 +1,70 @@
+#include "user_heap.h"
+
+#include "debug.h"
+#include "frame_mem.h"
+#include "mm.h"
+#include "paging.h"
+#include "scheduler.h"
+#include "stddef.h"
+
+struct user_info_t *user_info = NULL;
+
+static uint32_t page_up(uint32_t addr) {
+  return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+void setup_user_heap(void) {
+  const uint32_t phys = frame_alloc(0);
+  assert(phys != 0);
+  user_info = P2V(phys);
+  user_info->pid = getpid();
+  user_info->heap = 0;
+  // Read-only for user, shared by all address spaces
+  paging_map(pgdir, (void *)USER_INFO, phys, PG_USER);
+}
+
+int user_heap_create(struct process_t *ps) {
+  const int slot = mm_heap_slot_alloc(ps->mm);
+  if (slot < 0) return -1;
+  uint32_t *const dir = mm_dir(ps->mm);
+  void *const base = (void *)USER_HEAP(slot);
+  // A forked address space may still map a copy of an older heap here
+  paging_unmap_range(dir, base, (char *)base + USER_HEAP_SLOT);
+  if (paging_map_range(dir, base, (char *)base + USER_HEAP_STATE_SIZE, PG_USER | PG_WRITE) < 0) {
+    paging_unmap_range(dir, base, (char *)base + USER_HEAP_STATE_SIZE);
+    mm_heap_slot_free(ps->mm, slot);
+    return -1;
+  }
+  ps->heap_base = USER_HEAP(slot);
+  ps->heap_brk = USER_HEAP(slot) + USER_HEAP_STATE_SIZE;
+  return 0;
+}
+
+void user_heap_destroy(struct process_t *ps) {
+  if (ps->heap_brk == 0) return;
+  paging_unmap_range(mm_dir(ps->mm), (void *)ps->heap_base, (void *)page_up(ps->heap_brk));
+  mm_heap_slot_free(ps->mm, (ps->heap_base - USER_HEAP_BASE) / USER_HEAP_SLOT);
+  ps->heap_base = 0;
+  ps->heap_brk = 0;
+}
+
+void *user_heap_sbrk(long increment) {
+  struct process_t *const ps = getproc();
+  const uint32_t old = ps->heap_brk;
+  const uint32_t start = ps->heap_base + USER_HEAP_STATE_SIZE;
+  if (old == 0 || (increment < 0 && (uint32_t)-increment > old - start) ||
+      (increment > 0 && (uint32_t)increment > ps->heap_base + USER_HEAP_SLOT - old)) {
+    return (void *)-1;
+  }
+
+  uint32_t *const dir = mm_dir(ps->mm);
+  const uint32_t brk = old + increment;
+  if (increment > 0 &&
+      paging_map_range(dir, (void *)old, (void *)brk, PG_USER | PG_WRITE) < 0) {
+    paging_unmap_range(dir, (void *)page_up(old), (void *)page_up(brk));
+    return (void *)-1;
+  }
+  if (increment < 0) paging_unmap_range(dir, (void *)page_up(brk), (void *)page_up(old));
+  ps->heap_brk = brk;
+  return (void *)old;
+}
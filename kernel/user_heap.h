@@ -0,0 +1,25 @@
+/*
+ * Per-process user heaps, backed by page frames.
+ */
+#ifndef __USER_HEAP_H__
+#define __USER_HEAP_H__
+
+#include "system.h"
+
+struct process_t;
+
+/** Mapped at USER_INFO */
+extern struct user_info_t *user_info;
+
+/** Map USER_INFO page */
+void setup_user_heap(void);
+
+/** Reserve a heap slot in the process address space and map its zeroed
+ * allocator state page */
+int user_heap_create(struct process_t *ps);
+/** Unmap whole process heap */
+void user_heap_destroy(struct process_t *ps);
+/** Move running process heap break. Returns previous break or -1 */
+void *user_heap_sbrk(long increment);
+
+#endif
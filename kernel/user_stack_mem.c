@@ -2,16 +2,222 @@
  * Copyright (C) 2005 Simon Nieuviarts
  *
  * Memory allocator in user space for user stacks. Used by the kernel.
-	 */
+ *
+ * The window only reserves address space: a stack is a buddy block whose
+ * first page is an unmapped guard and whose other pages are mapped on first
+ * touch, in the address space of its process. Forked processes share the
+ * block of their parent stack, so blocks are reference counted.
+ */
 #include "user_stack_mem.h"
+#include "buddy.h"
+#include "debug.h"
+#include "mem.h"
+#include "mm.h"
+#include "paging.h"
+#include "start.h"
+#include "stddef.h"
+#include "string.h"
+
+extern char user_stack_heap[];
+
+#define STACK_WINDOW_START ((uint32_t)user_stack_heap)
+#define STACK_WINDOW_END ((uint32_t)user_end)
+/** Whole 8M window */
+#define STACK_MAX_ORDER 11
+/** Smallest stack block: one guard page and one stack page */
+#define STACK_MIN_ORDER 1
+/** Blocks up to 1M are cached, larger ones go straight to the window */
+#define STACK_CACHED_ORDER 8
+/** Cached stacks per class */
+#define STACK_CACHE_DEPTH 4
+
+/** State of each window page */
+enum stack_page_t {
+	STACK_PAGE_FREE = 0,
+	STACK_PAGE_GUARD,
+	STACK_PAGE_USED
+};
+
+struct stack_class_t {
+	/** Blocks of free stacks */
+	uint32_t cached[STACK_CACHE_DEPTH];
+	unsigned count;
+	unsigned long active;
+	unsigned long allocs;
+	unsigned long frees;
+};
+
+static struct buddy_t stack_space;
+static uint8_t *stack_pages = NULL;
+/** Address spaces using each block, indexed by its first page */
+static uint8_t *stack_refs = NULL;
+static struct stack_class_t stack_classes[STACK_CACHED_ORDER + 1];
+
+void setup_user_stacks(void)
+{
+	const unsigned long npages = (STACK_WINDOW_END - STACK_WINDOW_START) >> PAGE_SHIFT;
+	struct buddy_block_t *const blocks = mem_alloc(npages * sizeof(struct buddy_block_t));
+	stack_pages = mem_alloc(npages);
+	stack_refs = mem_alloc(npages);
+	assert(blocks != NULL && stack_pages != NULL && stack_refs != NULL);
+	memset(stack_pages, STACK_PAGE_FREE, npages);
+	buddy_init(&stack_space, STACK_WINDOW_START, npages, PAGE_SHIFT, STACK_MAX_ORDER, blocks);
+	buddy_add(&stack_space, STACK_WINDOW_START, STACK_WINDOW_END);
+}
+
+/** Order of the block for a stack of length bytes and its guard page */
+static unsigned stack_order(unsigned long length)
+{
+	unsigned order = STACK_MIN_ORDER;
+	while (order <= STACK_MAX_ORDER && ((unsigned long)PAGE_SIZE << order) - PAGE_SIZE < length) {
+		order++;
+	}
+	return order;
+}
+
+static void mark_pages(uint32_t block, unsigned order, enum stack_page_t state)
+{
+	const unsigned long first = (block - STACK_WINDOW_START) >> PAGE_SHIFT;
+	memset(&stack_pages[first], state, 1ul << order);
+	if (state == STACK_PAGE_USED) stack_pages[first] = STACK_PAGE_GUARD;
+}
+
+#define STACK_REFS(block) stack_refs[((block) - STACK_WINDOW_START) >> PAGE_SHIFT]
+
+/** Give a stack block back to the window. Its pages are already unmapped */
+static void stack_release(uint32_t block, unsigned order)
+{
+	mark_pages(block, order, STACK_PAGE_FREE);
+	buddy_free(&stack_space, block, order);
+}
+
+/** Give all cached stacks back to the window */
+static void stack_cache_flush(void)
+{
+	for (unsigned o = STACK_MIN_ORDER; o <= STACK_CACHED_ORDER; o++) {
+		struct stack_class_t *const sc = &stack_classes[o];
+		while (sc->count > 0) stack_release(sc->cached[--sc->count], o);
+	}
+}
+
+void *user_stack_alloc(struct mm_t *mm, unsigned long length)
+{
+	const unsigned order = stack_order(length);
+	if (order > STACK_MAX_ORDER || length == 0) return NULL;
+
+	struct stack_class_t *const sc = order <= STACK_CACHED_ORDER ? &stack_classes[order] : NULL;
+	uint32_t block = 0;
+	if (sc != NULL && sc->count > 0) {
+		block = sc->cached[--sc->count];
+	} else {
+		block = buddy_alloc(&stack_space, order);
+		if (block == 0) {
+			// Cached stacks may fill the window
+			stack_cache_flush();
+			block = buddy_alloc(&stack_space, order);
+		}
+		if (block == 0) return NULL;
+		mark_pages(block, order, STACK_PAGE_USED);
+	}
+	STACK_REFS(block) = 1;
+
+	// A forked address space may still map a copy of an older stack here
+	uint32_t *const dir = mm_dir(mm);
+	paging_unmap_range(dir, (void *)block, (void *)(block + (PAGE_SIZE << order)));
+	// The kernel writes the first frame at the top
+	char *const zone = (char *)block + PAGE_SIZE;
+	if (paging_map_range(dir, zone + length - 2 * sizeof(int32_t), zone + length,
+			     PG_USER | PG_WRITE) < 0) {
+		paging_unmap_range(dir, zone, zone + length);
+		stack_release(block, order);
+		return NULL;
+	}
+	if (sc != NULL) {
+		sc->allocs++;
+		sc->active++;
+	}
+	return zone;
+}
+
+void user_stack_share(void *zone)
+{
+	const uint32_t block = (uint32_t)zone - PAGE_SIZE;
+	assert(STACK_REFS(block) > 0 && STACK_REFS(block) < UINT8_MAX);
+	STACK_REFS(block)++;
+}
+
+void user_stack_unmap(struct mm_t *mm, void *zone, unsigned long length)
+{
+	paging_unmap_range(mm_dir(mm), zone, (char *)zone + length);
+}
+
+void user_stack_free(void *zone, unsigned long length)
+{
+	const unsigned order = stack_order(length);
+	const uint32_t block = (uint32_t)zone - PAGE_SIZE;
+	assert(STACK_REFS(block) > 0);
+	if (--STACK_REFS(block) > 0) return;
+	if (order > STACK_CACHED_ORDER) {
+		stack_release(block, order);
+		return;
+	}
+
+	struct stack_class_t *const sc = &stack_classes[order];
+	sc->frees++;
+	sc->active--;
+	if (sc->count < STACK_CACHE_DEPTH) {
+		sc->cached[sc->count++] = block;
+	} else {
+		stack_release(block, order);
+	}
+}
+
+int user_stack_fault(struct mm_t *mm, void *addr)
+{
+	const uint32_t a = (uint32_t)addr;
+	if (mm == NULL || stack_pages == NULL) return -1;
+	if (a < STACK_WINDOW_START || a >= STACK_WINDOW_END) return -1;
+	if (stack_pages[(a - STACK_WINDOW_START) >> PAGE_SHIFT] != STACK_PAGE_USED) return -1;
+	return paging_map_range(mm_dir(mm), addr, (char *)addr + 1, PG_USER | PG_WRITE);
+}
+
+unsigned long user_stack_used(struct mm_t *mm, void *zone, unsigned long length)
+{
+	// Stack pages come zeroed on first touch: the deepest word which is
+	// not zero, in the lowest mapped page, is the high-water mark
+	const uint32_t *const dir = mm_dir(mm);
+	char *const top = (char *)zone + length;
+	for (char *page = zone; page < top; page += PAGE_SIZE) {
+		const uint32_t phys = paging_lookup(dir, page, NULL);
+		if (phys == 0) continue;
+		const uint32_t *const words = P2V(phys);
+		for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint32_t) && page + i * sizeof(uint32_t) < top; i++) {
+			if (words[i] != 0) return top - (page + i * sizeof(uint32_t));
+		}
+	}
+	return 0;
+}
 
-#define mem_heap		user_stack_heap
-#define mem_heap_end		user_end
-#define mem_bug			user_stack_bug
-#define mem_alloc		user_stack_alloc
-#define mem_free		user_stack_free
-#define mem_free_nolength	user_stack_free_nolength
-#define sbrk			us_sbrk
+int user_stacks_status(struct slab_status_t *status, int count)
+{
+	if (count < 0) return -1;
 
-#define USE_THIS_CUSTOM_PREFIX kus
-#include "malloc.c.h"
+	const int nclasses = STACK_CACHED_ORDER - STACK_MIN_ORDER + 1;
+	for (int i = 0; i < nclasses && i < count; i++) {
+		const unsigned order = STACK_MIN_ORDER + i;
+		const struct stack_class_t *const sc = &stack_classes[order];
+		const unsigned long size = (unsigned long)PAGE_SIZE << order;
+		if (size >= 1ul << 20) {
+			sprintf(status[i].name, "stack-%luM", size >> 20);
+		} else {
+			sprintf(status[i].name, "stack-%luK", size >> 10);
+		}
+		status[i].size = size;
+		status[i].active = sc->active;
+		status[i].total = sc->active + sc->count;
+		status[i].slabs = sc->count;
+		status[i].allocs = sc->allocs;
+		status[i].frees = sc->frees;
+	}
+	return nclasses;
+}
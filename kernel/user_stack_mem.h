@@ -6,7 +6,33 @@
 #ifndef __USER_STACK_MEM_H__
 #define __USER_STACK_MEM_H__
 
-void *user_stack_alloc(unsigned long length);
+#include "system.h"
+
+/** Reserve the user stacks window */
+void setup_user_stacks(void);
+
+struct mm_t;
+
+/** Stacks are rounded with their guard page to a power of two size class.
+ * Recently freed ones are cached per class. A new stack has its top page
+ * mapped in mm */
+void *user_stack_alloc(struct mm_t *mm, unsigned long length);
+/** Use the stack of a forked process in its copy of the address space */
+void user_stack_share(void *zone);
+/** Release pages of a stack in mm */
+void user_stack_unmap(struct mm_t *mm, void *zone, unsigned long length);
+/** Drop one user of the stack block */
 void user_stack_free(void *zone, unsigned long length);
 
+/** Map the stack page at addr in mm on first touch. Returns -1 if addr is
+ * not in a stack (free or guard page) */
+int user_stack_fault(struct mm_t *mm, void *addr);
+
+/** Deepest use in bytes of a stack mapped in mm */
+unsigned long user_stack_used(struct mm_t *mm, void *zone, unsigned long length);
+
+/** Get N firsts stack classes status (slabs is the cached stacks count).
+ * Returns classes count */
+int user_stacks_status(struct slab_status_t *status, int count);
+
 #endif
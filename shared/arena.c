@@ -0,0 +1,88 @@
+#include "arena.h"
+
+struct arena_chunk_t {
+	struct arena_chunk_t *prev;
+	/** Chunk length, header included */
+	unsigned long length;
+};
+
+/** Chunk data starts aligned after its header */
+#define CHUNK_HEAD ((sizeof(struct arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static char *align_up(char *p)
+{
+	return (char *)(((unsigned long)p + ARENA_ALIGN - 1) & ~(unsigned long)(ARENA_ALIGN - 1));
+}
+
+void arena_init(struct arena_t *arena, void *buf, size_t size,
+		void *(*grow)(unsigned long), void (*release)(void *, unsigned long))
+{
+	arena->buf = buf;
+	arena->buf_end = (char *)buf + (buf != NULL ? size : 0);
+	arena->cur = arena->buf;
+	arena->end = arena->buf_end;
+	arena->chunk = NULL;
+	arena->grow = grow;
+	arena->release = release;
+}
+
+/** Chain a chunk with room for size bytes */
+static int arena_grow(struct arena_t *arena, size_t size)
+{
+	if (arena->grow == NULL || size > (size_t)-1 - CHUNK_HEAD - ARENA_ALIGN) return -1;
+	unsigned long length = CHUNK_HEAD + size;
+	if (length < ARENA_CHUNK_SIZE) length = ARENA_CHUNK_SIZE;
+	// Chunks double along the chain up to ARENA_CHUNK_MAX, so long runs
+	// need few of them
+	if (arena->chunk != NULL && arena->chunk->length < ARENA_CHUNK_MAX &&
+	    length < 2 * arena->chunk->length) {
+		length = 2 * arena->chunk->length;
+	}
+	struct arena_chunk_t *chunk = arena->grow(length);
+	if (chunk == NULL && length > CHUNK_HEAD + size) {
+		length = CHUNK_HEAD + size;
+		chunk = arena->grow(length);
+	}
+	if (chunk == NULL) return -1;
+	chunk->prev = arena->chunk;
+	chunk->length = length;
+	arena->chunk = chunk;
+	arena->cur = (char *)chunk + CHUNK_HEAD;
+	arena->end = (char *)chunk + length;
+	return 0;
+}
+
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	char *p = align_up(arena->cur);
+	if (p > arena->end || (size_t)(arena->end - p) < size) {
+		if (arena_grow(arena, size) < 0) return NULL;
+		p = arena->cur;
+	}
+	arena->cur = p + size;
+	return p;
+}
+
+struct arena_scope_t arena_enter(const struct arena_t *arena)
+{
+	struct arena_scope_t scope = { arena->chunk, arena->cur };
+	return scope;
+}
+
+void arena_leave(struct arena_t *arena, struct arena_scope_t scope)
+{
+	while (arena->chunk != scope.chunk) {
+		struct arena_chunk_t *const chunk = arena->chunk;
+		arena->chunk = chunk->prev;
+		arena->release(chunk, chunk->length);
+	}
+	arena->cur = scope.cur;
+	arena->end = arena->chunk != NULL ? (char *)arena->chunk + arena->chunk->length
+					  : arena->buf_end;
+}
+
+void arena_reset(struct arena_t *arena)
+{
+	const struct arena_scope_t start = { NULL, arena->buf };
+	arena_leave(arena, start);
+}
@@ -0,0 +1,55 @@
+/*
+ * Region allocator for short-lived work.
+ *
+ * Blocks are bumped out of a caller buffer and, when a grow function is
+ * given, out of chunks chained behind it. Nothing is freed one by one:
+ * leaving a scope releases everything allocated since it was entered.
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "stddef.h"
+
+/** Alignment of every block */
+#define ARENA_ALIGN 8
+/** Smallest chunk asked to the grow function, header included */
+#define ARENA_CHUNK_SIZE 4096
+/** Chunks stop doubling past this length */
+#define ARENA_CHUNK_MAX 65536
+
+struct arena_chunk_t;
+
+struct arena_t {
+	/** Free part of the current buffer or chunk */
+	char *cur;
+	char *end;
+	/** Last chained chunk or NULL while in the caller buffer */
+	struct arena_chunk_t *chunk;
+	/** Caller buffer */
+	char *buf;
+	char *buf_end;
+	/** Chunks allocator, NULL for a fixed size arena */
+	void *(*grow)(unsigned long length);
+	void (*release)(void *zone, unsigned long length);
+};
+
+/** Allocation point to come back to */
+struct arena_scope_t {
+	struct arena_chunk_t *chunk;
+	char *cur;
+};
+
+/** Setup arena on buf (may be NULL). grow and release may be NULL */
+void arena_init(struct arena_t *arena, void *buf, size_t size,
+		void *(*grow)(unsigned long), void (*release)(void *, unsigned long));
+/** Get an aligned block. Returns NULL if the arena cannot grow */
+void *arena_alloc(struct arena_t *arena, size_t size);
+
+/** Scopes nest: they must be left in reverse order */
+struct arena_scope_t arena_enter(const struct arena_t *arena);
+/** Free every block allocated since scope was entered */
+void arena_leave(struct arena_t *arena, struct arena_scope_t scope);
+/** Free every block and release all chunks */
+void arena_reset(struct arena_t *arena);
+
+#endif
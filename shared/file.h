@@ -33,7 +33,51 @@ enum file_attr {
   FILE_DIRECTORY = 0x10
 };
 
+/** fs_open flags */
+enum file_open_flags {
+  /** Create the file if not found. Its directory must exist */
+  OPEN_CREATE = 0x1,
+  /** Empty the file */
+  OPEN_TRUNCATE = 0x2,
+  /** Every write goes to the end of file */
+  OPEN_APPEND = 0x4
+};
+
+/** fs_lseek origins */
+enum file_seek {
+  SEEK_SET,
+  SEEK_CUR,
+  SEEK_END
+};
+
+/** Finished asynchronous request, see fs_async_poll */
+struct file_completion_t {
+  int id;
+  /** Error or transferred size */
+  int result;
+};
+
 #define FILE_SHORTNAME_SIZE 31
+/** File fragmentation, see fs_frag_report */
+struct file_frag_t {
+  char name[FILE_SHORTNAME_SIZE+1];
+  /** Allocation units */
+  uint32_t clusters;
+  /** Contiguous runs of clusters, each costing a seek */
+  uint32_t extents;
+};
+/** Volume fragmentation, see fs_frag_report */
+struct volume_frag_t {
+  uint32_t files;
+  /** Files of more than one extent */
+  uint32_t fragmented;
+  uint32_t clusters;
+  uint32_t extents;
+  uint32_t freeClusters;
+  /** Contiguous runs of free clusters */
+  uint32_t freeRuns;
+};
+
 /** File descriptor */
 typedef struct FILE {
   /** Name or first part of it */
@@ -59,4 +103,15 @@ typedef struct DIR {
   uint32_t clusterIndex;
 } DIR;
 
+/** Position in a directory listing, set by fs_opendir */
+typedef struct DIR_CURSOR {
+  DIR dir;
+  /** Internal value */
+  uint32_t cluster;
+  /** Internal value */
+  uint32_t entry;
+  /** Internal value */
+  uint32_t done;
+} DIR_CURSOR;
+
 #endif
\ No newline at end of file
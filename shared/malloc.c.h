@@ -1,10 +1,13 @@
 /*** REMOVE LIBC DEPENDENCIES -- Simon Nieuviarts ***/
 #define LACKS_UNISTD_H
 #define LACKS_SYS_PARAM_H
+#ifndef HAVE_MMAP
 #define HAVE_MMAP 0
+#endif
 #define MALLOC_FAILURE_ACTION
 #define fprintf(f, ...) printf(__VA_ARGS__)
 #include "string.h"
+#ifndef MORECORE
 extern char mem_heap[];
 extern char mem_heap_end[];
 static char *curptr = mem_heap;
@@ -16,6 +19,7 @@ void *sbrk(ptrdiff_t diff)
 	curptr = c;
 	return s;
 }
+#endif
 /*** Furthermore, some small modifications have been made below ***/
 
 /*
@@ -2462,7 +2466,9 @@ typedef struct malloc_state *mstate;
    all zeroes (as is true of C statics).
 */
 
+#ifndef MALLOC_STATE
 static struct malloc_state av_;  /* never directly referenced */
+#endif
 
 /*
    All uses of av_ are via get_malloc_state().
@@ -2472,7 +2478,12 @@ static struct malloc_state av_;  /* never directly referenced */
    Also, it is called in check* routines if DEBUG is set.
 */
 
+#ifndef MALLOC_STATE
 #define get_malloc_state() (&(av_))
+#else
+/* Zero-filled state provided by the includer */
+#define get_malloc_state() ((mstate)(MALLOC_STATE))
+#endif
 
 /*
   Initialize a malloc_state struct.
@@ -3877,6 +3888,7 @@ void fREe(mem) Void_t* mem;
       ret = munmap((char*)p - offset, size + offset);
       /* munmap returns non-zero on failure */
       assert(ret == 0);
+      (void)ret;
 #endif
     }
   }
@@ -5587,6 +5599,11 @@ History:
  * Copyright (C) 2005 Simon Nieuviarts
  *
  * Defensive wrapper on top of the memory allocator.
+ *
+ * Each block starts with the return address of its mem_alloc caller, its
+ * site entry, its length and a guard word. When MEM_SITES is defined, live
+ * blocks are accounted per allocation site in a table of MEM_SITES entries
+ * (a power of two). Sites which do not fit share one more entry, of site 0.
  */
 
 static void mem_bug(const char *_reason)
@@ -5595,37 +5612,82 @@ static void mem_bug(const char *_reason)
 	*(char *)0 = 1;
 }
 
-void *mem_alloc(unsigned long length)
+/** Words before the block */
+#define MEM_HEAD 4
+/** Block words with the head and the tail guards */
+#define MEM_WORDS(length) (((length) + sizeof(unsigned long) - 1) \
+	/ sizeof(unsigned long) + MEM_HEAD + 2)
+
+#ifdef MEM_SITES
+static struct heap_site_t mem_sites[MEM_SITES + 1];
+static unsigned long mem_allocs = 0;
+static unsigned long mem_frees = 0;
+
+/** Entry of site, inserted on first use */
+static unsigned long mem_site_index(unsigned long site)
 {
-	unsigned long l = ((length + sizeof(unsigned long) - 1)
-		/ sizeof(unsigned long)) + 4;
+	unsigned long i = (site >> 2) & (MEM_SITES - 1);
+	for (int n = 0; n < MEM_SITES; n++) {
+		if (mem_sites[i].site == site) return i;
+		if (mem_sites[i].site == 0) {
+			mem_sites[i].site = site;
+			return i;
+		}
+		i = (i + 1) & (MEM_SITES - 1);
+	}
+	return MEM_SITES;
+}
+#endif
+
+static void *mem_alloc_site(unsigned long length, unsigned long site)
+{
+	unsigned long l = MEM_WORDS(length);
 	unsigned long l2 = l * sizeof(unsigned long);
 	unsigned long *p;
 	if (!length) return 0;
 	if (l2 <= length) return 0;
 	p = public_mALLOc(l2);
 	if (!p) return 0;
-	p[0] = length;
-	p[1] = 0xa51234ab;
+	p[0] = site;
+	p[1] = 0;
+#ifdef MEM_SITES
+	p[1] = mem_site_index(site);
+	mem_sites[p[1]].count++;
+	mem_sites[p[1]].bytes += length;
+	mem_sites[p[1]].allocs++;
+	mem_allocs++;
+#endif
+	p[2] = length;
+	p[3] = 0xa51234ab;
 	p[l-2] = 0xdeadfedc;
 	p[l-1] = (unsigned long)p;
-	p = p+2;
-	memset(p, 0, l2 - 4 * sizeof(unsigned long));
+	p = p + MEM_HEAD;
+	memset(p, 0, l2 - (MEM_HEAD + 2) * sizeof(unsigned long));
 	return p;
 }
 
+void *mem_alloc(unsigned long length)
+{
+	return mem_alloc_site(length, (unsigned long)__builtin_return_address(0));
+}
+
 
 void mem_free(void *zone, unsigned long length)
 {
 	unsigned long *p = zone;
-	unsigned long l = ((length + sizeof(unsigned long) - 1)
-		/ sizeof(unsigned long)) + 4;
+	unsigned long l = MEM_WORDS(length);
 	if (!length) return;
-	p -= 2;
-	if (p[1] != 0xa51234ab) mem_bug("allocator error : memory just before the block corrupted or block already freed");
-	if (p[0] != length) mem_bug("allocator error : not the same length as when allocated");
+	p -= MEM_HEAD;
+	if (p[3] != 0xa51234ab) mem_bug("allocator error : memory just before the block corrupted or block already freed");
+	if (p[2] != length) mem_bug("allocator error : not the same length as when allocated");
 	if (p[l-2] != 0xdeadfedc) mem_bug("allocator error : memory just after the block corrupted");
 	if (p[l-1] != (unsigned long)p) mem_bug("allocator error : wrong block address or memory just after the block corrupted");
+#ifdef MEM_SITES
+	if (p[1] > MEM_SITES) mem_bug("allocator error : memory just before the block corrupted");
+	mem_sites[p[1]].count--;
+	mem_sites[p[1]].bytes -= length;
+	mem_frees++;
+#endif
 	memset(p, 0, l * sizeof(unsigned long)); // Help to catch usage after a free
 	public_fREe(p);
 }
@@ -5634,3 +5696,68 @@ void mem_free_nolength(void *zone)
 {
 	mem_free(zone, ((unsigned long *)zone)[-2]);
 }
+
+void mem_heap_status(struct heap_status_t *status)
+{
+	const struct mallinfo mi = public_mALLINFo();
+	status->system = mi.arena + mi.hblkhd;
+	status->in_use = mi.uordblks + mi.hblkhd;
+	status->free = mi.fordblks;
+	status->free_chunks = mi.ordblks;
+	// Free space which cannot be given back from the top chunk, per mille
+	const unsigned long scale = (mi.fordblks + 999) / 1000;
+	status->fragmentation = scale ? (mi.fordblks - mi.keepcost) / scale : 0;
+	if (status->fragmentation > 1000) status->fragmentation = 1000;
+#ifdef MEM_SITES
+	status->live = mem_allocs - mem_frees;
+	status->allocs = mem_allocs;
+	status->frees = mem_frees;
+#else
+	status->live = status->allocs = status->frees = 0;
+#endif
+}
+
+#ifdef MEM_SITES
+static unsigned long mem_site_key(const struct heap_site_t *e, int order)
+{
+	return order == HEAP_SITES_BY_COUNT ? e->count : e->bytes;
+}
+
+int mem_heap_sites(struct heap_site_t *sites, int count, int order)
+{
+	unsigned char taken[MEM_SITES + 1];
+	int used = 0;
+	memset(taken, 0, sizeof(taken));
+	for (int i = 0; i <= MEM_SITES; i++) {
+		if (mem_sites[i].allocs > 0) used++;
+	}
+	// Selection of the count first sites, the table keeps its hash order
+	for (int n = 0; n < count && n < used; n++) {
+		int best = -1;
+		for (int i = 0; i <= MEM_SITES; i++) {
+			if (mem_sites[i].allocs == 0 || taken[i]) continue;
+			if (best < 0 || mem_site_key(&mem_sites[i], order) > mem_site_key(&mem_sites[best], order)) {
+				best = i;
+			}
+		}
+		taken[best] = 1;
+		sites[n] = mem_sites[best];
+	}
+	return used;
+}
+
+int mem_heap_leaks(void (*line)(const char *))
+{
+	char buf[80];
+	int n = 0;
+	for (int i = 0; i <= MEM_SITES; i++) {
+		const struct heap_site_t *const e = &mem_sites[i];
+		if (e->count == 0) continue;
+		sprintf(buf, "leak: site %p: %lu blocks, %lu bytes (%lu allocs)\n", (void *)e->site,
+			e->count, e->bytes, e->allocs);
+		line(buf);
+		n++;
+	}
+	return n;
+}
+#endif
@@ -22,8 +22,12 @@
 #define CONSOLE_WHITE 15
 
 #define NOPID -1
+/** Return value of processes killed by an invalid memory access */
+#define RETVAL_SEGFAULT -11
 #define NBPROC 30
 #define NBQUEUE 300
+/** Open files per process */
+#define NBFILES 16
 
 
 enum process_state_t {
@@ -42,7 +46,13 @@ enum process_state_t {
   /** Waiting on an empty queue */
   PS_WAIT_QUEUE_EMPTY,
   /** Waiting on a full queue */
-  PS_WAIT_QUEUE_FULL
+  PS_WAIT_QUEUE_FULL,
+  /** Calling a server which is not receiving yet */
+  PS_IPC_SEND,
+  /** Waiting server reply */
+  PS_IPC_REPLY,
+  /** Server waiting next call */
+  PS_IPC_RECEIVE
 };
 struct process_status_t {
   int pid;
@@ -53,6 +63,96 @@ struct process_status_t {
   enum process_state_t state;
   /** user_stack size in bytes */
   unsigned long ssize;
+  /** Deepest user and kernel stack use in bytes */
+  unsigned long stack_used;
+  unsigned long kstack_used;
+};
+
+#define IPC_MSG_WORDS 4
+/** Rendezvous message, copied inline between kernel stacks */
+struct ipc_msg_t {
+  int w[IPC_MSG_WORDS];
+};
+
+/** User heaps area: one slot per process of an address space, starting
+ * with its allocator state */
+#define USER_HEAP_BASE 0x40000000u
+#define USER_HEAP_SLOT 0x4000000u
+#define USER_HEAP_STATE_SIZE 0x1000u
+#define USER_HEAP(slot) (USER_HEAP_BASE + (unsigned)(slot) * USER_HEAP_SLOT)
+
+/** Read-only page kept up to date by the kernel for the running process */
+struct user_info_t {
+  int pid;
+  /** Heap slot address */
+  unsigned heap;
+};
+#define USER_INFO ((const volatile struct user_info_t *)(USER_HEAP_BASE - 0x1000))
+
+/** Allocator usage, from dlmalloc mallinfo and mem_alloc counters */
+struct heap_status_t {
+  /** Bytes obtained from the system */
+  unsigned long system;
+  /** Bytes in allocated and free chunks */
+  unsigned long in_use;
+  unsigned long free;
+  /** Free chunks count */
+  unsigned long free_chunks;
+  /** Free bytes outside the top chunk, per mille of free bytes */
+  unsigned long fragmentation;
+  /** mem_alloc blocks, when allocation sites are recorded */
+  unsigned long live;
+  unsigned long allocs;
+  unsigned long frees;
+};
+
+/** mem_alloc call site, identified by its return address */
+struct heap_site_t {
+  unsigned long site;
+  /** Live blocks and their bytes */
+  unsigned long count;
+  unsigned long bytes;
+  /** Blocks allocated since boot */
+  unsigned long allocs;
+};
+#define HEAP_SITES_BY_BYTES 0
+#define HEAP_SITES_BY_COUNT 1
+
+/** Physical memory and kernel heap usage */
+struct meminfo_t {
+  /** Page frames */
+  unsigned long frames;
+  unsigned long free_frames;
+  struct heap_status_t heap;
+};
+
+/** Disk block cache usage */
+struct disk_cache_status_t {
+  unsigned long block_size;
+  unsigned long blocks;
+  /** Blocks holding data, and not written back yet */
+  unsigned long used;
+  unsigned long dirty;
+  unsigned long hits;
+  unsigned long misses;
+  /** Blocks written back and buffers reused */
+  unsigned long writebacks;
+  unsigned long evictions;
+  /** Blocks loaded ahead of reads */
+  unsigned long prefetches;
+};
+
+struct slab_status_t {
+  char name[20];
+  /** Object size in bytes */
+  unsigned long size;
+  /** Allocated objects */
+  unsigned long active;
+  /** Allocated and cached objects */
+  unsigned long total;
+  unsigned long slabs;
+  unsigned long allocs;
+  unsigned long frees;
 };
 
 struct queue_status_t {
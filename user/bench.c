@@ -0,0 +1,73 @@
+#include "bench.h"
+
+#include "stdio.h"
+#include "syscall.h"
+
+#define ROUND_TRIPS 1000
+
+static unsigned long long rdtsc() {
+  unsigned long long tsc;
+  __asm__ __volatile__("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/** Request and reply queues of queue_server */
+static int queue_fids[2];
+
+static int queue_server(void *arg) {
+  (void)arg;
+  int msg;
+  while (preceive(queue_fids[0], &msg) == 0) {
+    if (psend(queue_fids[1], msg + 1) < 0) break;
+  }
+  return 0;
+}
+static int rendezvous_server(void *arg) {
+  (void)arg;
+  struct ipc_msg_t msg;
+  int client = reply_and_wait(NOPID, NULL, &msg);
+  while (client >= 0) {
+    msg.w[0]++;
+    client = reply_and_wait(client, &msg, &msg);
+  }
+  return 0;
+}
+
+static unsigned long bench_queue(int prio) {
+  queue_fids[0] = pcreate(1);
+  queue_fids[1] = pcreate(1);
+  const int pid = start(queue_server, 2000, prio, "queue_server", NULL);
+  int msg = 0;
+  const unsigned long long start_tsc = rdtsc();
+  for (int i = 0; i < ROUND_TRIPS; i++) {
+    psend(queue_fids[0], msg);
+    preceive(queue_fids[1], &msg);
+  }
+  const unsigned long long end_tsc = rdtsc();
+  if (msg != ROUND_TRIPS) printf("queue: lost messages (%d)\n", msg);
+  // NOTE: server ends on queue deletion
+  pdelete(queue_fids[0]);
+  pdelete(queue_fids[1]);
+  waitpid(pid, NULL);
+  return (unsigned long)(end_tsc - start_tsc) / ROUND_TRIPS;
+}
+static unsigned long bench_rendezvous(int prio) {
+  const int pid = start(rendezvous_server, 2000, prio, "rdv_server", NULL);
+  struct ipc_msg_t msg = {{0}};
+  const unsigned long long start_tsc = rdtsc();
+  for (int i = 0; i < ROUND_TRIPS; i++) {
+    call(pid, &msg, &msg);
+  }
+  const unsigned long long end_tsc = rdtsc();
+  if (msg.w[0] != ROUND_TRIPS) printf("rendezvous: lost messages (%d)\n", msg.w[0]);
+  kill(pid);
+  waitpid(pid, NULL);
+  return (unsigned long)(end_tsc - start_tsc) / ROUND_TRIPS;
+}
+
+void bench_ipc() {
+  const int prio = getprio(getpid());
+  printf("%d round trips\n", ROUND_TRIPS);
+  printf("queue:      %lu cycles\n", bench_queue(prio));
+  printf("rendezvous: %lu cycles\n", bench_rendezvous(prio));
+}
@@ -0,0 +1,7 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/** Compare rendezvous and queue based request/reply latency */
+void bench_ipc();
+
+#endif
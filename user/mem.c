@@ -4,6 +4,14 @@
  * User memory allocator.
  */
 #include "mem.h"
+#include "syscall.h"
+
+/* Each process has its own heap slot, given by the kernel. The allocator
+ * state is at the beginning of the slot, so processes never share it */
+#define MORECORE sbrk
+#define MALLOC_STATE USER_INFO->heap
 
 #define USE_THIS_CUSTOM_PREFIX u
 #include "malloc.c.h"
+
+typedef char malloc_state_fits_slot[sizeof(struct malloc_state) <= USER_HEAP_STATE_SIZE ? 1 : -1];
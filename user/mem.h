@@ -6,7 +6,12 @@
 #ifndef __MEM_H__
 #define __MEM_H__
 
+struct heap_status_t;
+
 void *mem_alloc(unsigned long length);
 void mem_free(void *zone, unsigned long length);
 
+/** Heap usage of the running process */
+void mem_heap_status(struct heap_status_t *status);
+
 #endif
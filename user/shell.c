@@ -1,10 +1,12 @@
 #include "syscall.h"
+#include "arena.h"
 #include "stdio.h"
 #include "logo.h"
 #include "string.h"
 #include "shell.h"
 #include "mem.h"
 #include "play.h"
+#include "bench.h"
 
 int test_proc(void *arg);
 
@@ -18,11 +20,17 @@ static struct {
   {"uptime", uptime, "Display how long the system has been up"},
   {"test", test, "Launch the test interface"},
   {"sys_info", sys_info, "Display some system information"},
+  {"slabs", slabs, "Display kernel object and stack caches"},
+  {"free", _free, "Display memory usage"},
+  {"bcache", bcache, "Display disk block cache usage"},
+  {"sync", _sync, "Write file metadata and cached disk blocks back"},
+  {"defrag", defrag, "Report file fragmentation and make files contiguous"},
   {"reboot", reboot, "Reboot the system"},
   {"help", help, "Display this help screen"},
   {"logo", logo, "Display the logo"},
   {"beep", _beep, "Play a short beep"},
   {"ping", ping, "Ping in background"},
+  {"ipc", bench_ipc, "Compare rendezvous and queue latency"},
   {"exit", _exit, "Close this shell"},
   {0, 0, 0}
 };
@@ -35,12 +43,21 @@ static struct {
   {"cd", cd, "Change current directory"},
   {"ls", ls, "List files in directory"},
   {"cat", cat, "Print file content"},
+  {"touch", touch, "Create an empty file"},
+  {"rm", rm, "Remove a file"},
+  {"append", append, "Append a line of text to a file"},
   {"play", play, "Play a music beep file"},
+  {"meminfo", _meminfo, "Display kernel allocation sites, or dump leaks on serial"},
   {0, 0, 0}
 };
 
+/** Scratch memory of the running command, freed when it returns */
+static char command_buffer[4096];
+static struct arena_t command_arena;
+
 void shell() {
   const char NONE = '\0';
+  arena_init(&command_arena, command_buffer, sizeof(command_buffer), mem_alloc, mem_free);
   while (1) {
     char buffer[CONSOLE_COL] = {0};
     printf("> ");
@@ -48,6 +65,7 @@ void shell() {
     char* firstWord = strchr(buffer, ' ');
     if (firstWord) *firstWord = '\0';
   
+    const struct arena_scope_t scope = arena_enter(&command_arena);
     for (int i = 0; keywords[i].name; i++) {
       if (strcmp(keywords[i].name, buffer) == 0) {
         keywords[i].f();
@@ -60,6 +78,7 @@ void shell() {
         break;
       }
     }
+    arena_leave(&command_arena, scope);
   }
 }
 int shell_proc(void * arg) {
@@ -76,17 +95,20 @@ const char* PROCESS_STATE_NAMES[] = {
   "asleep",
   "wait child",
   "wait queue empty",
-  "wait queue full"
+  "wait queue full",
+  "ipc send",
+  "ipc reply",
+  "ipc receive"
 };
 void ps() {
   struct process_status_t status[20];
   const int nproc = processes_status(status, 20);
-  printf("PID\tNAME\t\tSTATE\t\tPRIO\tPARENT\tSSIZE\n");
-  for (int i = 0; i < nproc; i++) {
+  printf("PID\tNAME\t\tSTATE\t\tPRIO\tPARENT\tSSIZE\tSUSED\tKUSED\n");
+  for (int i = 0; i < nproc && i < 20; i++) {
     struct process_status_t* const ps = &status[i];
-    printf("%d\t%-15s\t%-15s\t%d\t%d\t%lu\n", ps->pid, ps->name,
+    printf("%d\t%-15s\t%-15s\t%d\t%d\t%lu\t%lu\t%lu\n", ps->pid, ps->name,
       PROCESS_STATE_NAMES[ps->state-PS_DEAD],
-      ps->prio, ps->parent, ps->ssize);
+      ps->prio, ps->parent, ps->ssize, ps->stack_used, ps->kstack_used);
   }
 }
 void qs() {
@@ -99,6 +121,91 @@ void qs() {
   }
 }
 
+void slabs() {
+  struct slab_status_t status[20];
+  const int ncaches = slabs_status(status, 20);
+  printf("CACHE\t\tSIZE\tACTIVE\tTOTAL\tSLABS\tALLOCS\tFREES\n");
+  for (int i = 0; i < ncaches && i < 20; i++) {
+    struct slab_status_t* const c = &status[i];
+    printf("%-15s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", c->name, c->size,
+      c->active, c->total, c->slabs, c->allocs, c->frees);
+  }
+  const int nclasses = stacks_status(status, 20);
+  printf("STACK\t\tSIZE\tACTIVE\tTOTAL\tCACHED\tALLOCS\tFREES\n");
+  for (int i = 0; i < nclasses && i < 20; i++) {
+    struct slab_status_t* const c = &status[i];
+    printf("%-15s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", c->name, c->size,
+      c->active, c->total, c->slabs, c->allocs, c->frees);
+  }
+}
+
+static void print_heap(const char *name, const struct heap_status_t *h) {
+  printf("%-15s\t%luK\t%luK\t%luK\t%lu.%lu%%\n", name, h->system >> 10, h->in_use >> 10,
+    h->free >> 10, h->fragmentation / 10, h->fragmentation % 10);
+}
+void _free() {
+  struct meminfo_t info;
+  struct heap_status_t own;
+  meminfo(&info);
+  mem_heap_status(&own);
+  printf("\t\tTOTAL\tUSED\tFREE\tFRAGMENTED\n");
+  printf("%-15s\t%luK\t%luK\t%luK\n", "frames", info.frames * 4,
+    (info.frames - info.free_frames) * 4, info.free_frames * 4);
+  print_heap("kernel heap", &info.heap);
+  print_heap("shell heap", &own);
+}
+
+void bcache() {
+  struct disk_cache_status_t c;
+  fs_cache_status(&c);
+  printf("BLOCKS\tUSED\tDIRTY\tHITS\tMISSES\tWRITES\tEVICTS\tAHEAD\n");
+  printf("%lux%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", c.blocks, c.block_size, c.used,
+    c.dirty, c.hits, c.misses, c.writebacks, c.evictions, c.prefetches);
+}
+void _sync() { fs_sync(); }
+
+#define DEFRAG_FILES 16
+static void print_volume(const struct volume_frag_t *v) {
+  printf("%u files, %u fragmented, %u clusters in %u extents, %u free in %u runs\n",
+    v->files, v->fragmented, v->clusters, v->extents, v->freeClusters, v->freeRuns);
+}
+void defrag() {
+  struct volume_frag_t v;
+  struct file_frag_t files[DEFRAG_FILES];
+  const int n = fs_frag_report(&v, files, DEFRAG_FILES);
+  printf("CLUSTERS\tEXTENTS\tNAME\n");
+  for (int i = 0; i < n && i < DEFRAG_FILES; i++) {
+    printf("%u\t\t%u\t%s\n", files[i].clusters, files[i].extents, files[i].name);
+  }
+  print_volume(&v);
+  printf("Moved %d clusters\n", fs_defrag(&v));
+  print_volume(&v);
+}
+
+#define MEMINFO_SITES 8
+static void print_sites(const char *title, int order) {
+  struct heap_site_t sites[MEMINFO_SITES];
+  const int n = heap_sites(sites, MEMINFO_SITES, order);
+  printf("%s\nSITE\t\tLIVE\tBYTES\tALLOCS\n", title);
+  for (int i = 0; i < n && i < MEMINFO_SITES; i++) {
+    printf("%p\t%lu\t%lu\t%lu\n", (void*)sites[i].site, sites[i].count,
+      sites[i].bytes, sites[i].allocs);
+  }
+}
+void _meminfo(const char* arg) {
+  if (strcmp(arg, "leaks") == 0) {
+    printf("%d sites with live blocks dumped on serial\n", heap_leaks());
+    return;
+  }
+  struct meminfo_t info;
+  meminfo(&info);
+  _free();
+  printf("kernel blocks: %lu live, %lu allocs, %lu frees\n", info.heap.live,
+    info.heap.allocs, info.heap.frees);
+  print_sites("Top sites by bytes", HEAP_SITES_BY_BYTES);
+  print_sites("Top sites by blocks", HEAP_SITES_BY_COUNT);
+}
+
 static struct {
 	const char *name;
 	int val;
@@ -155,11 +262,8 @@ void logo() { printf(CALMOS_LOGO); }
 void _beep() { beep(1000, .1f); }
 
 DIR pwd = {0};
-int find_file(FILE* f, const char* name) {
-  for (size_t i = 0;; i++) {
-    if (fs_list(pwd, f, 1, i) <= 0) return 0;
-    if (strcmp(name, f->name) == 0) return 1;
-  }
+int find_file(FILE* f, const char* path) {
+  return fs_lookup(pwd, path, f) == 0;
 }
 void ls(const char* path) {
   FILE files[20];
@@ -172,32 +276,73 @@ void ls(const char* path) {
     }
   }
 
-  int nfiles = fs_list(root, &files[0], 20, 0);
-  for (int i = 0; i < nfiles; i++) {
-    struct fat_datetime_t d = files[i].modifiedAt;
-    printf("%c %8d \t%02d/%02d/%04d %02d:%02d \t%s\n",
-           files[i].attribs & FILE_DIRECTORY ? 'd' : '-', files[i].size,
-           d.date.day, d.date.month, d.date.year + FAT_YEAR_OFFSET, d.time.hour,
-           d.time.minutes, files[i].name);
+  DIR_CURSOR cursor;
+  fs_opendir(root, &cursor);
+  int nfiles;
+  while ((nfiles = fs_readdir(&cursor, &files[0], 20)) > 0) {
+    for (int i = 0; i < nfiles; i++) {
+      struct fat_datetime_t d = files[i].modifiedAt;
+      printf("%c %8d \t%02d/%02d/%04d %02d:%02d \t%s\n",
+             files[i].attribs & FILE_DIRECTORY ? 'd' : '-', files[i].size,
+             d.date.day, d.date.month, d.date.year + FAT_YEAR_OFFSET, d.time.hour,
+             d.time.minutes, files[i].name);
+    }
   }
 }
 void cat(const char* path) {
+  const int fd = path && *path != '\0' ? fs_open(pwd, path, 0) : -1;
+  if (fd >= 0) {
+    // Up to end of file
+    fs_sendfile(fd, (size_t)-1);
+    fs_close(fd);
+  } else {
+    cons_write("File not found\n", 15);
+  }
+}
+void touch(const char* path) {
+  FILE f;
+  if (!path || *path == '\0') {
+    cons_write("Missing file name\n", 18);
+  } else if (!find_file(&f, path) && fs_create(pwd, path, &f) < 0) {
+    cons_write("Cannot create file\n", 19);
+  }
+}
+void rm(const char* path) {
   FILE f;
   if (path && *path != '\0' && find_file(&f, path) && !(f.attribs & FILE_DIRECTORY)) {
-    char buffer[CONSOLE_COL*CONSOLE_LIG];
-    for (size_t offset = 0; offset < f.size; offset += CONSOLE_COL*CONSOLE_LIG) {
-      memset(buffer, 0, CONSOLE_COL*CONSOLE_LIG);
-      int size = fs_read(buffer, &f, offset, CONSOLE_COL*CONSOLE_LIG);
-      if (size <= 0) break;
-      cons_write(buffer, size);
-    }
+    if (fs_unlink(&f) < 0) cons_write("Cannot remove file\n", 20);
   } else {
     cons_write("File not found\n", 15);
   }
 }
+void append(const char* args) {
+  char path[CONSOLE_COL];
+  const char* text = strchr(args, ' ');
+  const size_t len = text ? (size_t)(text - args) : strlen(args);
+  memcpy(path, args, len);
+  path[len] = '\0';
+  text = text ? text + 1 : "";
+
+  const int fd = len > 0 ? fs_open(pwd, path, OPEN_CREATE | OPEN_APPEND) : -1;
+  if (fd == -2) {
+    cons_write("File not found\n", 15);
+    return;
+  }
+  if (fd < 0) {
+    cons_write("Cannot create file\n", 19);
+    return;
+  }
+  const size_t textLen = strlen(text);
+  if (fs_fwrite(fd, text, textLen) != (int)textLen || fs_fwrite(fd, "\n", 1) != 1) {
+    cons_write("Cannot write file\n", 18);
+  }
+  fs_close(fd);
+}
 void cd(const char* path) {
   FILE f;
-  if (path && *path != '\0' && find_file(&f, path) && (f.attribs & FILE_DIRECTORY)) {
+  if (path && strcmp(path, "/") == 0) {
+    pwd = fs_root();
+  } else if (path && *path != '\0' && find_file(&f, path) && (f.attribs & FILE_DIRECTORY)) {
     pwd.clusterIndex = f.clusterIndex;
   } else {
     cons_write("Directory not found\n", 20);
@@ -207,12 +352,16 @@ void cd(const char* path) {
 void play(const char* path) {
   FILE f;
   if (path && *path != '\0' && find_file(&f, path) && !(f.attribs & FILE_DIRECTORY)) {
-    char* buffer = mem_alloc(f.size);
-    fs_read(buffer, &f, 0, f.size);
+    // Pages are read as lines are decoded. The byte past the file is 0
+    char* buffer = fs_mmap(&f, 0, f.size + 1);
+    if (buffer == (char*)-1) {
+      cons_write("Out of memory\n", 14);
+      return;
+    }
     for (char* eol = buffer-1; eol && eol < buffer + f.size; eol = strchr(eol+1, '\n')) {
       decode_music_line(eol+1);
     }
-    mem_free(buffer, f.size);
+    fs_munmap(buffer);
   } else {
     cons_write("File not found\n", 15);
   }
@@ -16,6 +16,15 @@ void uptime();
 void test();
 /** Display some system information */
 void sys_info();
+/** Display kernel object caches */
+void slabs();
+/** Display memory usage */
+void _free();
+/** Display disk block cache usage */
+void bcache();
+/** Write file metadata and cached disk blocks back */
+void _sync();
+void defrag();
 /** Close this shell */
 void _exit();
 /** Display help screen */
@@ -34,7 +43,15 @@ void cd(const char*);
 void ls(const char*);
 /** Print file content */
 void cat(const char*);
+/** Create an empty file */
+void touch(const char*);
+/** Remove a file */
+void rm(const char*);
+/** Append a line of text to a file */
+void append(const char*);
 /** Play a music beep file */
 void play(const char *);
+/** Display kernel allocation sites, or dump leaks on serial with "leaks" */
+void _meminfo(const char *);
 
 #endif
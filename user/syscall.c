@@ -40,6 +40,10 @@ int preceive(int fid, int *message) { return SYS_call_2(43, fid, message); }
 int preset(int fid) { return SYS_call_1(44, fid); }
 int psend(int fid, int message) { return SYS_call_2(45, fid, message); }
 int queues_status(struct queue_status_t *status, int count) { return SYS_call_2(46, status, count); }
+int call(int pid, const struct ipc_msg_t *msg, struct ipc_msg_t *reply) { return SYS_call_3(47, pid, msg, reply); }
+int reply_and_wait(int client, const struct ipc_msg_t *reply, struct ipc_msg_t *msg) {
+  return SYS_call_3(48, client, reply, msg);
+}
 
 void clock_settings(unsigned long *quartz, unsigned long *ticks) { SYS_call_2(50, quartz, ticks); }
 unsigned long current_clock(void) { return SYS_call_0(51); }
@@ -70,4 +74,52 @@ int fs_read(void *dst, const FILE *f, size_t offset, size_t len) {
 }
 int fs_write(const FILE *f, size_t offset, const void *src, size_t len) {
   return SYS_call_4(74, f, offset, src, len);
-}
\ No newline at end of file
+}
+void fs_sync(void) { SYS_call_0(75); }
+void fs_cache_status(struct disk_cache_status_t *status) { SYS_call_1(76, status); }
+int fs_lookup(const DIR dir, const char *path, FILE *file) {
+  return SYS_call_3(77, &dir, path, file);
+}
+void fs_opendir(const DIR dir, DIR_CURSOR *cursor) { SYS_call_2(78, &dir, cursor); }
+int fs_readdir(DIR_CURSOR *cursor, FILE *files, size_t nfiles) {
+  return SYS_call_3(79, cursor, files, nfiles);
+}
+int fs_create(const DIR dir, const char *name, FILE *file) {
+  return SYS_call_3(80, &dir, name, file);
+}
+int fs_truncate(const FILE *f, size_t size) { return SYS_call_2(81, f, size); }
+int fs_unlink(const FILE *f) { return SYS_call_1(82, f); }
+void *fs_mmap(const FILE *f, size_t offset, size_t length) {
+  return (void *)SYS_call_3(83, f, offset, length);
+}
+int fs_munmap(void *addr) { return SYS_call_1(84, addr); }
+int fs_open(const DIR dir, const char *path, int flags) {
+  return SYS_call_3(85, &dir, path, flags);
+}
+int fs_close(int fd) { return SYS_call_1(86, fd); }
+int fs_fread(int fd, void *dst, size_t len) { return SYS_call_3(87, fd, dst, len); }
+int fs_fwrite(int fd, const void *src, size_t len) { return SYS_call_3(88, fd, src, len); }
+int fs_lseek(int fd, long offset, int whence) { return SYS_call_3(89, fd, offset, whence); }
+
+int slabs_status(struct slab_status_t *status, int count) { return SYS_call_2(90, status, count); }
+void *sbrk(ptrdiff_t increment) { return (void *)SYS_call_1(91, increment); }
+int stacks_status(struct slab_status_t *status, int count) { return SYS_call_2(92, status, count); }
+int fork(void) { return SYS_call_0(93); }
+int meminfo(struct meminfo_t *info) { return SYS_call_1(94, info); }
+int heap_sites(struct heap_site_t *sites, int count, int order) { return SYS_call_3(95, sites, count, order); }
+int heap_leaks(void) { return SYS_call_0(96); }
+
+int fs_read_async(int fd, void *dst, size_t offset, size_t len, int fid) {
+  return SYS_call_5(100, fd, dst, offset, len, fid);
+}
+int fs_write_async(int fd, const void *src, size_t offset, size_t len, int fid) {
+  return SYS_call_5(101, fd, src, offset, len, fid);
+}
+int fs_async_poll(struct file_completion_t *done, int count) {
+  return SYS_call_2(102, done, count);
+}
+int fs_sendfile(int fd, size_t len) { return SYS_call_2(103, fd, len); }
+int fs_frag_report(struct volume_frag_t *volume, struct file_frag_t *files, size_t nfiles) {
+  return SYS_call_3(104, volume, files, nfiles);
+}
+int fs_defrag(struct volume_frag_t *volume) { return SYS_call_1(105, volume); }
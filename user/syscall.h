@@ -29,6 +29,12 @@ int preset(int fid);                  // 44
 int psend(int fid, int message);      // 45
 /** Get N firsts queues status. Returns total queues count */
 int queues_status(struct queue_status_t *status, int count);  // 46
+/** Send msg to server pid and wait its reply (may be NULL).
+ * Return 0 or negative if invalid pid or server ended */
+int call(int pid, const struct ipc_msg_t *msg, struct ipc_msg_t *reply);  // 47
+/** Reply to client (if not NOPID) then wait next call in msg.
+ * Return calling process pid */
+int reply_and_wait(int client, const struct ipc_msg_t *reply, struct ipc_msg_t *msg);  // 48
 
 void clock_settings(unsigned long *quartz, unsigned long *ticks);  // 50
 unsigned long current_clock(void);                                 // 51
@@ -43,15 +49,95 @@ void reboot();                           // 63
 
 /** Get top level folder */
 DIR fs_root();                                                              // 70
-/** Get file list in directory.
+/** Get file list in directory, skipping offset files.
  * Return error or number of files.
  * Takes an array of file_t */
 int fs_list(const DIR dir, FILE *files, size_t nfiles, size_t offset);      // 71
 /** Get full filename. len does not include \0 */
 void fs_file_name(const FILE *f, char *name, size_t len);                   // 72
-/** Read file part. Return error or readded size */
+/** Read file part. Sequential reads get following data prefetched in the
+ * background. Return error or readded size */
 int fs_read(void *dst, const FILE *f, size_t offset, size_t len);           // 73
-/** Write file part. Return error or written size */
+/** Write file part. Writing at the end of file appends to it.
+ * Return error or written size */
 int fs_write(const FILE *f, size_t offset, const void *src, size_t len);    //74
+/** Write back file metadata and cached disk blocks */
+void fs_sync(void);                                                         // 75
+/** Get disk block cache usage */
+void fs_cache_status(struct disk_cache_status_t *status);                   // 76
+/** Find file at path, relative to dir unless it starts with '/'.
+ * Return 0, -1 if not found or -2 if a component is not a directory */
+int fs_lookup(const DIR dir, const char *path, FILE *file);                 // 77
+/** Start listing dir */
+void fs_opendir(const DIR dir, DIR_CURSOR *cursor);                         // 78
+/** Get next files of listing and move cursor past them.
+ * Return error or number of files, 0 at the end */
+int fs_readdir(DIR_CURSOR *cursor, FILE *files, size_t nfiles);             // 79
+/** Create empty file name in dir. Name must fit 8.3, as no long name is
+ * written. Return 0, -1 on error or -3 if name already exists */
+int fs_create(const DIR dir, const char *name, FILE *file);                 // 80
+/** Shrink file to size. Return error or 0 */
+int fs_truncate(const FILE *f, size_t size);                                // 81
+/** Remove file, directories and files open through a descriptor are
+ * refused. Return error or 0 */
+int fs_unlink(const FILE *f);                                               // 82
+/** Map length bytes of file from offset, a multiple of 4096, in the
+ * process. Pages are read on first touch, writes stay private.
+ * Returns mapping address or (void *)-1 */
+void *fs_mmap(const FILE *f, size_t offset, size_t length);                 // 83
+/** Remove mapping at addr. Return error or 0 */
+int fs_munmap(void *addr);                                                  // 84
+/** Open file at path, relative to dir unless it starts with '/', with
+ * file_open_flags. Return descriptor, -1 on error or -2 if path or a
+ * component is a directory, resp. not a directory */
+int fs_open(const DIR dir, const char *path, int flags);                    // 85
+/** Release descriptor. Return error or 0 */
+int fs_close(int fd);                                                       // 86
+/** Read from descriptor position and move it. Sequential reads get
+ * following data prefetched in the background. Return error or readded size */
+int fs_fread(int fd, void *dst, size_t len);                                // 87
+/** Write at descriptor position and move it. Return error or written size */
+int fs_fwrite(int fd, const void *src, size_t len);                         // 88
+/** Move descriptor position to offset from whence (see file_seek).
+ * Return new position or error */
+int fs_lseek(int fd, long offset, int whence);                              // 89
+
+/** Get N firsts kernel object caches status. Returns total caches count */
+int slabs_status(struct slab_status_t *status, int count);                 // 90
+/** Move process heap break. Returns previous break or (void *)-1 */
+void *sbrk(ptrdiff_t increment);                                            // 91
+/** Get N firsts user stack size classes status. Returns classes count */
+int stacks_status(struct slab_status_t *status, int count);                // 92
+/** Copy the process with a copy-on-write address space. Returns child pid,
+ * 0 in the child, or a negative value */
+int fork(void);                                                             // 93
+/** Get page frames and kernel heap usage */
+int meminfo(struct meminfo_t *info);                                        // 94
+/** Get N first kernel allocation sites by live bytes or blocks
+ * (HEAP_SITES_BY_*). Returns sites count */
+int heap_sites(struct heap_site_t *sites, int count, int order);           // 95
+/** Dump kernel allocation sites with live blocks over serial. Returns their count */
+int heap_leaks(void);                                                       // 96
+
+/** Read len bytes of descriptor fd at offset in dst, in the background.
+ * On completion the request id is sent to queue fid, unless it is
+ * negative or full. Returns request id or -1 */
+int fs_read_async(int fd, void *dst, size_t offset, size_t len, int fid);   // 100
+/** Write len bytes of src to descriptor fd at offset, or at its end if
+ * opened for appending, in the background. See fs_read_async */
+int fs_write_async(int fd, const void *src, size_t offset, size_t len, int fid); // 101
+/** Collect up to count finished requests, oldest first, with their error
+ * or transferred size. Returns their count */
+int fs_async_poll(struct file_completion_t *done, int count);               // 102
+/** Write len bytes from descriptor position to the console, without
+ * copying them out of the kernel block cache, and move the position.
+ * Return error or written size */
+int fs_sendfile(int fd, size_t len);                                        // 103
+/** Fill volume with fragmentation of the disk, and files with the first
+ * nfiles regular files. Return the count of regular files */
+int fs_frag_report(struct volume_frag_t *volume, struct file_frag_t *files, size_t nfiles); // 104
+/** Make fragmented files contiguous, packed from the start of the disk.
+ * Fill volume with the result. Return moved clusters */
+int fs_defrag(struct volume_frag_t *volume);                                // 105
 
 #endif
\ No newline at end of file
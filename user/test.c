@@ -99,7 +99,7 @@ typedef __gnuc_va_list va_list;
  * tourner les tests au niveau utilisateur ou, si l'implantation du mode
  * utilisateur ne fonctionne pas, dans le repertoire kernel pour faire
  * tourner les tests au niveau superviseur.
- * Les tests sont separes en 20 fonctions qui testent differentes parties du
+ * Les tests sont separes en 23 fonctions qui testent differentes parties du
  * projet.
  * Aucune modification ne doit etre apportee a ce fichier pour la soutenance.
  *
@@ -138,6 +138,24 @@ void wait_clock(unsigned long wakeup);
 int start(int (*ptfunc)(void *), unsigned long ssize, int prio, const char *name, void *arg);
 int waitpid(int pid, int *retval);
 
+// Prototype des appels systeme propres a ce noyau (tests 21 et suivants)
+#include "file.h"
+int fork(void);
+DIR fs_root();
+int fs_read(void *dst, const FILE *f, size_t offset, size_t len);
+int fs_write(const FILE *f, size_t offset, const void *src, size_t len);
+int fs_lookup(const DIR dir, const char *path, FILE *file);
+int fs_create(const DIR dir, const char *name, FILE *file);
+int fs_truncate(const FILE *f, size_t size);
+int fs_unlink(const FILE *f);
+int fs_open(const DIR dir, const char *path, int flags);
+int fs_close(int fd);
+int fs_fwrite(int fd, const void *src, size_t len);
+int fs_read_async(int fd, void *dst, size_t offset, size_t len, int fid);
+int fs_async_poll(struct file_completion_t *done, int count);
+void fs_sync(void);
+int fs_frag_report(struct volume_frag_t *volume, struct file_frag_t *files, size_t nfiles);
+
 /*
  * Pour la soutenance, devrait afficher la liste des processus actifs, des
  * files de messages utilisees et toute autre info utile sur le noyau.
@@ -2661,6 +2679,191 @@ test20(void)
 	}
 }
 
+/*******************************************************************************
+ * Test 21
+ *
+ * fork() : le fils voit la memoire du pere au moment du fork, puis chacun
+ * garde ses propres ecritures (copie sur ecriture)
+ ******************************************************************************/
+static int cow_global = 1;
+
+static void
+test21(void)
+{
+	int local = 10;
+	int fid = pcreate(1);
+	int pid, rval;
+
+	assert(fid >= 0);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		int seen = cow_global == 1 && local == 10;
+		cow_global = 2;
+		local = 20;
+		/* Le pere ecrit pendant ce temps */
+		assert(preceive(fid, 0) == 0);
+		exit(seen && cow_global == 2 && local == 20 ? 21 : 0);
+	}
+	printf("1");
+	cow_global = 3;
+	local = 30;
+	assert(psend(fid, 0) == 0);
+	printf(" 2");
+	assert(waitpid(pid, &rval) == pid);
+	assert(rval == 21);
+	assert(cow_global == 3);
+	assert(local == 30);
+	assert(pdelete(fid) == 0);
+	printf(" 3.\n");
+}
+
+/*******************************************************************************
+ * Test 22
+ *
+ * Fichier cree, agrandi, tronque puis supprime : le contenu relu est celui
+ * ecrit, l'entree effacee ne designe plus aucun fichier et ses clusters
+ * sont rendus
+ ******************************************************************************/
+static void
+test22(void)
+{
+	static char data[3000], back[3000];
+	const DIR root = fs_root();
+	FILE f, g;
+	struct volume_frag_t before, after;
+	int i;
+
+	for (i = 0; i < 3000; i++) data[i] = 'a' + i % 26;
+	/* Reste d'un test interrompu */
+	if (fs_lookup(root, "/TEST22.TXT", &f) == 0) assert(fs_unlink(&f) == 0);
+	/* Clusters libres une fois les reservations rendues par fs_sync */
+	fs_sync();
+	fs_frag_report(&before, NULL, 0);
+	assert(fs_create(root, "TEST22.TXT", &f) == 0);
+	assert(fs_create(root, "TEST22.TXT", &g) == -3);
+	/* Pas de nom long : le nom serait coupe */
+	assert(fs_create(root, "TEST22LONG.TXT", &g) == -1);
+	assert(fs_create(root, "TEST22.TEXT", &g) == -1);
+	assert(fs_write(&f, 0, data, 1000) == 1000);
+	assert(fs_write(&f, 1000, data + 1000, 2000) == 2000);
+	assert(fs_lookup(root, "/test22.txt", &g) == 0);
+	assert(g.size == 3000);
+	fs_sync();
+	assert(fs_frag_report(&after, NULL, 0) == (int)before.files + 1);
+	assert(after.freeClusters < before.freeClusters);
+	printf("1");
+
+	assert(fs_read(back, &g, 0, 3000) == 3000);
+	for (i = 0; i < 3000; i++) assert(back[i] == data[i]);
+	printf(" 2");
+
+	assert(fs_truncate(&g, 1500) == 0);
+	assert(fs_truncate(&g, 2000) == -1);
+	assert(fs_lookup(root, "/TEST22.TXT", &g) == 0);
+	assert(g.size == 1500);
+	assert(fs_read(back, &g, 1000, 3000) == 500);
+	for (i = 0; i < 500; i++) assert(back[i] == data[1000 + i]);
+	printf(" 3");
+
+	assert(fs_unlink(&g) == 0);
+	assert(fs_lookup(root, "/TEST22.TXT", &f) == -1);
+	assert(fs_read(back, &g, 0, 1) == -1);
+	assert(fs_write(&g, 0, data, 1) == -1);
+	assert(fs_unlink(&g) == -1);
+	fs_sync();
+	fs_frag_report(&after, NULL, 0);
+	assert(after.freeClusters == before.freeClusters);
+	printf(" 4.\n");
+}
+
+/*******************************************************************************
+ * Test 23
+ *
+ * Lectures asynchrones : les fins arrivent sur la file dans l'ordre ou
+ * fs_async_poll les rend, et les requetes d'un processus termine sont
+ * abandonnees sans garder de place
+ ******************************************************************************/
+/* Requetes en cours pour tout le systeme (FILE_AIO_REQUESTS du noyau) */
+#define AIO_REQUESTS 32
+
+static void
+test23(void)
+{
+	static char data[4096], bufs[4][512];
+	const DIR root = fs_root();
+	struct file_completion_t done[8];
+	int ids[4], got[4];
+	int fd, fid, fid2, pid, rval, i, j, n;
+	unsigned long quartz, ticks, deadline;
+	FILE f;
+
+	clock_settings(&quartz, &ticks);
+	for (i = 0; i < 4096; i++) data[i] = 'A' + i % 23;
+	fd = fs_open(root, "/TEST23.TXT", OPEN_CREATE | OPEN_TRUNCATE);
+	assert(fd >= 0);
+	assert(fs_fwrite(fd, data, 4096) == 4096);
+	fid = pcreate(4);
+	assert(fid >= 0);
+	for (i = 0; i < 4; i++) {
+		ids[i] = fs_read_async(fd, bufs[i], i * 1024, 512, fid);
+		assert(ids[i] > 0);
+	}
+	for (i = 0; i < 4; i++) assert(preceive(fid, &got[i]) == 0);
+	assert(fs_async_poll(done, 8) == 4);
+	for (i = 0; i < 4; i++) {
+		assert(done[i].id == got[i]);
+		assert(done[i].result == 512);
+		for (j = 0; j < 4 && ids[j] != got[i]; j++);
+		assert(j < 4);
+	}
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 512; j++) assert(bufs[i][j] == data[i * 1024 + j]);
+	}
+	assert(fs_async_poll(done, 8) == 0);
+	printf("1");
+
+	fid2 = pcreate(8);
+	assert(fid2 >= 0);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		for (i = 0; i < 8; i++) fs_read_async(fd, data, 0, 4096, fid2);
+		exit(0);
+	}
+	assert(waitpid(pid, &rval) == pid);
+	printf(" 2");
+
+	/* Toutes les places se liberent une fois le fils termine */
+	deadline = current_clock() + 5 * quartz / ticks;
+	for (n = 0; n < AIO_REQUESTS;) {
+		if (fs_read_async(fd, bufs[0], 0, 1, -1) > 0) {
+			n++;
+		} else {
+			assert(current_clock() < deadline);
+			wait_clock(current_clock() + 1);
+		}
+	}
+	while (n > 0) {
+		const int k = fs_async_poll(done, 8);
+		for (i = 0; i < k; i++) assert(done[i].result == 1);
+		n -= k;
+		if (k == 0) {
+			assert(current_clock() < deadline);
+			wait_clock(current_clock() + 1);
+		}
+	}
+	assert(fs_async_poll(done, 8) == 0);
+	printf(" 3");
+
+	assert(pdelete(fid2) == 0);
+	assert(pdelete(fid) == 0);
+	assert(fs_close(fd) == 0);
+	assert(fs_lookup(root, "/TEST23.TXT", &f) == 0);
+	assert(fs_unlink(&f) == 0);
+	printf(" 4.\n");
+}
+
 /*******************************************************************************
  * Fin des tests
  ******************************************************************************/
@@ -2697,6 +2900,9 @@ static struct {
 	{"18", test18},
 	{"19", test19},
 	{"20", test20},
+	{"21", test21},
+	{"22", test22},
+	{"23", test23},
 	{"si", sys_info},
 	{"a", auto_test},
 	{"auto", auto_test},
@@ -2721,7 +2927,7 @@ int
 test_run(int n)
 {
 	assert(getprio(getpid()) == 128);
-	if ((n < 1) || (n > 20)) {
+	if ((n < 1) || (n > 23)) {
 		printf("%d: unknown test\n", n);
 	} else {
 		commands[n - 1].f();
@@ -2749,7 +2955,7 @@ test_proc(void *arg)
 
 	while (1) {
 		int i = 0;
-		printf("Test (1-20, auto) : ");
+		printf("Test (1-23, auto) : ");
 		cons_gets(buffer, 20);
 		while (commands[i].name && strcmp(commands[i].name, buffer)) i++;
 		if (!commands[i].name) {